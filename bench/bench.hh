@@ -0,0 +1,39 @@
+// Copyright 2017-2018 ccls Authors
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace ccls::bench {
+struct Benchmark {
+  const char *name;
+  const char *description;
+  void (*run)();
+};
+
+std::vector<Benchmark> &benchmarks();
+
+// Define a static Register to add a benchmark to ccls-bench.
+struct Register {
+  Register(const char *name, const char *description, void (*run)()) {
+    benchmarks().push_back({name, description, run});
+  }
+};
+
+// Return the wall time of |fn| in seconds.
+template <typename Fn> double wallTime(Fn &&fn) {
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Identifiers shaped like workspace/symbol and completion candidates:
+// qualified camelCase, snake_case and UPPER_CASE names.
+std::vector<std::string> makeCandidates(int n);
+
+// Print |seconds| spent on |items| items, and the throughput.
+void report(const std::string &label, double seconds, double items);
+} // namespace ccls::bench
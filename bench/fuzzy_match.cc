@@ -0,0 +1,68 @@
+// Copyright 2017-2018 ccls Authors
+// SPDX-License-Identifier: Apache-2.0
+
+#include "bench.hh"
+
+#include "fuzzy_match.hh"
+
+#include <llvm/Support/CommandLine.h>
+
+#include <random>
+#include <stdio.h>
+
+using namespace llvm;
+
+namespace ccls::bench {
+std::vector<std::string> makeCandidates(int n) {
+  static const char *const words[] = {"get",   "set",    "index",  "file",   "query", "symbol", "range",
+                                      "type",  "func",   "var",    "update", "path",  "cache",  "match",
+                                      "score", "buffer", "string", "map",    "token", "node"};
+  std::mt19937 rng(0);
+  std::vector<std::string> ret;
+  for (int i = 0; i < n; i++) {
+    std::string s;
+    if (rng() % 2)
+      s += rng() % 2 ? "ccls::" : "llvm::sys::";
+    int style = rng() % 3, m = 1 + rng() % 4;
+    for (int j = 0; j < m; j++) {
+      std::string w = words[rng() % std::size(words)];
+      if (style == 2)
+        for (char &c : w)
+          c = char(c - 'a' + 'A');
+      else if (style == 0 && j)
+        w[0] = char(w[0] - 'a' + 'A');
+      if (style && j)
+        s += '_';
+      s += w;
+    }
+    if (rng() % 4 == 0)
+      s += std::to_string(rng() % 100);
+    ret.push_back(std::move(s));
+  }
+  return ret;
+}
+
+namespace {
+cl::opt<int> opt_candidates("fuzzy-candidates", cl::desc("fuzzy: number of candidate symbol names"),
+                            cl::init(200000));
+cl::opt<int> opt_rounds("fuzzy-rounds", cl::desc("fuzzy: passes over the candidates per pattern"), cl::init(5));
+
+void run() {
+  std::vector<std::string> candidates = makeCandidates(opt_candidates);
+  static const char *const patterns[] = {"gs", "index", "qSym", "upd_path", "SCORE", "mtch", "zzq"};
+  for (const char *pattern : patterns) {
+    FuzzyMatcher matcher(pattern, 1);
+    size_t matched = 0;
+    double t = wallTime([&] {
+      for (int r = 0; r < opt_rounds; r++)
+        for (auto &c : candidates)
+          matched += matcher.match(c, false) > FuzzyMatcher::kMinScore;
+    });
+    report(std::string("match \"") + pattern + "\" (" + std::to_string(matched / opt_rounds) + " matched)", t,
+           double(candidates.size()) * opt_rounds);
+  }
+}
+
+Register reg("fuzzy", "FuzzyMatcher::match over synthetic symbol names", run);
+} // namespace
+} // namespace ccls::bench
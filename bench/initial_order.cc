@@ -0,0 +1,128 @@
+// Copyright 2017-2018 ccls Authors
+// SPDX-License-Identifier: Apache-2.0
+
+#include "bench.hh"
+
+#include "project.hh"
+#include "serializer.hh"
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Support/CommandLine.h>
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <random>
+#include <stdio.h>
+
+using namespace llvm;
+
+namespace ccls::bench {
+namespace {
+cl::opt<int> opt_dirs("order-dirs", cl::desc("order: directories of TUs"), cl::init(100));
+cl::opt<int> opt_tus("order-tus", cl::desc("order: TUs per directory"), cl::init(40));
+cl::opt<int> opt_threads("order-threads", cl::desc("order: simulated indexer threads"), cl::init(8));
+cl::opt<double> opt_parse("order-parse",
+                          cl::desc("order: cost of a header claimed by another TU, relative to indexing it"),
+                          cl::init(0.2));
+
+// A project of libraries shared by directories: every TU includes the common
+// headers, part of the headers of the libraries used by its directory and a
+// few headers of its own directory.
+std::vector<std::vector<const char *>> makeProject(int dirs, int tus) {
+  const int kCommon = 50, kLibs = 30, kLibHeaders = 40, kDirHeaders = 10;
+  std::mt19937 rng(0);
+  std::vector<std::vector<const char *>> ret;
+  for (int d = 0; d < dirs; d++) {
+    int libs[3];
+    for (int &lib : libs)
+      lib = rng() % kLibs;
+    for (int t = 0; t < tus; t++) {
+      std::vector<const char *> deps;
+      for (int h = 0; h < kCommon; h++)
+        deps.push_back(intern("/usr/include/common" + std::to_string(h) + ".h"));
+      for (int lib : libs)
+        for (int h = 0; h < kLibHeaders; h++)
+          if (rng() % 5 < 3)
+            deps.push_back(intern("/src/lib" + std::to_string(lib) + "/h" + std::to_string(h) + ".h"));
+      for (int h = 0; h < kDirHeaders; h++)
+        if (rng() % 2)
+          deps.push_back(intern("/src/dir" + std::to_string(d) + "/h" + std::to_string(h) + ".h"));
+      std::sort(deps.begin(), deps.end());
+      deps.erase(std::unique(deps.begin(), deps.end()), deps.end());
+      ret.push_back(std::move(deps));
+    }
+  }
+  return ret;
+}
+
+// List-schedule |order| on |threads| indexers. A TU claims the headers which
+// no earlier TU has claimed when it starts, costing 1 each, and parses the
+// others at |parse|. Return the makespan and the time when every shared
+// header has been indexed.
+std::pair<double, double> simulate(const std::vector<std::vector<const char *>> &deps, const std::vector<int> &order,
+                                   int threads, double parse) {
+  DenseMap<const char *, int> count;
+  for (auto &tu : deps)
+    for (const char *path : tu)
+      count[path]++;
+  DenseMap<const char *, bool> claimed;
+  std::priority_queue<double, std::vector<double>, std::greater<double>> free_at;
+  for (int i = 0; i < threads; i++)
+    free_at.push(0);
+  double makespan = 0, shared_done = 0;
+  for (int i : order) {
+    double start = free_at.top(), cost = 1;
+    bool claims_shared = false;
+    free_at.pop();
+    for (const char *path : deps[i])
+      if (!claimed[path]) {
+        claimed[path] = true;
+        cost += 1;
+        claims_shared |= count[path] > 1;
+      } else {
+        cost += parse;
+      }
+    free_at.push(start + cost);
+    makespan = std::max(makespan, start + cost);
+    if (claims_shared)
+      shared_done = std::max(shared_done, start + cost);
+  }
+  return {makespan, shared_done};
+}
+
+void run() {
+  std::vector<std::vector<const char *>> deps = makeProject(opt_dirs, opt_tus);
+  std::vector<ArrayRef<const char *>> refs(deps.begin(), deps.end());
+  size_t total = 0;
+  for (auto &tu : deps)
+    total += tu.size();
+  printf("  %zu TUs, %zu dependencies, %d threads\n", deps.size(), total, int(opt_threads));
+
+  // initialOrder without a recorded order: directories interleaved.
+  std::vector<int> interleaved;
+  for (int t = 0; t < opt_tus; t++)
+    for (int d = 0; d < opt_dirs; d++)
+      interleaved.push_back(d * opt_tus + t);
+
+  std::vector<int> claimers;
+  report("headerClaimers", wallTime([&] { claimers = headerClaimers(refs); }), total);
+  std::vector<int> first = claimers;
+  std::vector<bool> picked(deps.size());
+  for (int i : claimers)
+    picked[i] = true;
+  for (int i : interleaved)
+    if (!picked[i])
+      first.push_back(i);
+  printf("  %zu claimers\n", claimers.size());
+
+  for (auto &[label, order] : {std::pair<const char *, std::vector<int> &>{"interleaved", interleaved},
+                               std::pair<const char *, std::vector<int> &>{"claimers first", first}}) {
+    auto [makespan, shared_done] = simulate(deps, order, opt_threads, opt_parse);
+    printf("  %-36s makespan %10.0f shared headers indexed at %10.0f\n", label, makespan, shared_done);
+  }
+}
+
+Register reg("order", "initial index order: claimers of shared headers first vs. interleaved directories", run);
+} // namespace
+} // namespace ccls::bench
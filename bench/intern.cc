@@ -0,0 +1,95 @@
+// Copyright 2017-2018 ccls Authors
+// SPDX-License-Identifier: Apache-2.0
+
+#include "bench.hh"
+
+#include "serializer.hh"
+
+#include <llvm/ADT/CachedHashString.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/Support/Allocator.h>
+#include <llvm/Support/CommandLine.h>
+
+#include <algorithm>
+#include <mutex>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+using namespace llvm;
+
+namespace ccls::bench {
+namespace {
+cl::opt<int> opt_threads("intern-threads", cl::desc("intern: maximum number of interning threads"),
+                         cl::init(std::max(4u, std::thread::hardware_concurrency())));
+cl::opt<int> opt_strings("intern-strings", cl::desc("intern: distinct strings, each interned by every thread"),
+                         cl::init(200000));
+
+// The interner before sharding: one set and allocator behind one mutex.
+struct GlobalInterner {
+  BumpPtrAllocator alloc;
+  DenseSet<CachedHashStringRef> strings;
+  std::mutex mutex;
+
+  const char *intern(StringRef s) {
+    CachedHashStringRef hs(s);
+    std::lock_guard lock(mutex);
+    auto r = strings.insert(hs);
+    if (r.second) {
+      char *p = alloc.Allocate<char>(s.size() + 1);
+      memcpy(p, s.data(), s.size());
+      p[s.size()] = '\0';
+      *r.first = CachedHashStringRef(StringRef(p, s.size()), hs.hash());
+    }
+    return r.first->val().data();
+  }
+};
+
+// Like the strings of indexer threads parsing TUs that share headers, every
+// thread interns the same vocabulary in its own order, so that the first
+// occurrence of each string inserts and the others hit.
+template <typename Fn> double runThreads(int threads, const std::vector<std::string> &strs, Fn &&fn) {
+  std::vector<std::vector<uint32_t>> orders(threads);
+  for (int t = 0; t < threads; t++) {
+    orders[t].resize(strs.size());
+    for (uint32_t i = 0; i < strs.size(); i++)
+      orders[t][i] = i;
+    std::shuffle(orders[t].begin(), orders[t].end(), std::mt19937(t));
+  }
+  return wallTime([&] {
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+      workers.emplace_back([&, t] {
+        for (uint32_t i : orders[t])
+          fn(strs[i]);
+      });
+    for (auto &w : workers)
+      w.join();
+  });
+}
+
+void run() {
+  int n = opt_strings;
+  printf("  %d strings per thread\n", n);
+  for (int threads = 1; threads <= opt_threads; threads *= 2) {
+    // A fresh vocabulary per round, so that the shared interner inserts again.
+    std::vector<std::string> strs;
+    for (int i = 0; i < n; i++)
+      strs.push_back("c:@N@ccls@S@Round" + std::to_string(threads) + "@F@symbol" + std::to_string(i) + "#");
+    GlobalInterner global;
+    std::string suffix = " (" + std::to_string(threads) + " threads)";
+    report("single mutex" + suffix, runThreads(threads, strs, [&](const std::string &s) { global.intern(s); }),
+           double(n) * threads);
+    report("intern" + suffix, runThreads(threads, strs, [](const std::string &s) { intern(s); }),
+           double(n) * threads);
+    for (auto &s : strs)
+      s += '~';
+    report("internReclaimable" + suffix,
+           runThreads(threads, strs, [](const std::string &s) { internReclaimable(s); }), double(n) * threads);
+  }
+}
+
+Register reg("intern", "string interning from N threads: sharded interner vs. a single mutex", run);
+} // namespace
+} // namespace ccls::bench
@@ -0,0 +1,49 @@
+// Copyright 2017-2018 ccls Authors
+// SPDX-License-Identifier: Apache-2.0
+
+#include "bench.hh"
+
+#include "log.hh"
+
+#include <llvm/Support/CommandLine.h>
+
+#include <algorithm>
+#include <stdio.h>
+
+using namespace llvm;
+
+namespace ccls {
+// Defined in main.cc of ccls.
+std::vector<std::string> g_init_options;
+
+namespace bench {
+std::vector<Benchmark> &benchmarks() {
+  static std::vector<Benchmark> ret;
+  return ret;
+}
+
+void report(const std::string &label, double seconds, double items) {
+  printf("  %-36s %10.3f ms %14.0f/s\n", label.c_str(), seconds * 1000, seconds > 0 ? items / seconds : 0.);
+  fflush(stdout);
+}
+} // namespace bench
+} // namespace ccls
+
+namespace {
+cl::list<std::string> opt_names(cl::Positional, cl::desc("[benchmark...]"));
+cl::opt<bool> opt_list("list", cl::desc("list benchmarks"));
+} // namespace
+
+int main(int argc, char **argv) {
+  cl::ParseCommandLineOptions(argc, argv, "ccls micro-benchmarks\n");
+  ccls::log::file = stderr;
+  ccls::log::verbosity = ccls::log::Verbosity_WARNING;
+  for (auto &b : ccls::bench::benchmarks())
+    if (opt_list)
+      printf("%-16s %s\n", b.name, b.description);
+    else if (opt_names.empty() || std::find(opt_names.begin(), opt_names.end(), b.name) != opt_names.end()) {
+      printf("%s: %s\n", b.name, b.description);
+      b.run();
+    }
+  return 0;
+}
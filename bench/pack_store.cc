@@ -0,0 +1,101 @@
+// Copyright 2017-2018 ccls Authors
+// SPDX-License-Identifier: Apache-2.0
+
+#include "bench.hh"
+
+#include "pack_store.hh"
+#include "utils.hh"
+
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+
+#include <stdio.h>
+
+using namespace llvm;
+
+namespace ccls::bench {
+namespace {
+cl::opt<int> opt_files("pack-files", cl::desc("pack: number of cached source files"), cl::init(20000));
+cl::opt<int> opt_content("pack-content", cl::desc("pack: bytes of source content per file"), cl::init(4096));
+cl::opt<int> opt_blob("pack-blob", cl::desc("pack: bytes of serialized index per file"), cl::init(16384));
+
+// Emulate .ccls-cache with hierarchicalPath: a directory tree of source paths,
+// each with the content and a .blob.
+std::string cachePath(const std::string &dir, int i) {
+  return dir + "/project/dir" + std::to_string(i % 97) + "/sub" + std::to_string(i % 13) + "/file" +
+         std::to_string(i) + ".cc";
+}
+
+void run() {
+  SmallString<128> dir;
+  if (sys::fs::createUniqueDirectory("ccls-bench-pack", dir)) {
+    fprintf(stderr, "failed to create a temporary directory\n");
+    return;
+  }
+  std::string root(dir.str());
+  int n = opt_files;
+  std::string content(opt_content, 'c'), blob(opt_blob, 'b');
+  std::vector<std::string> paths;
+  for (int i = 0; i < n; i++)
+    paths.push_back(cachePath(root, i));
+  printf("  %d files, %d + %d bytes each, in %s\n", n, int(opt_content), int(opt_blob), root.c_str());
+
+  size_t bytes = 0;
+  report("per-file: write", wallTime([&] {
+           for (auto &path : paths) {
+             sys::fs::create_directories(sys::path::parent_path(path));
+             writeToFile(path, content);
+             writeToFile(path + ".blob", blob);
+           }
+         }),
+         n);
+  report("per-file: read", wallTime([&] {
+           for (auto &path : paths) {
+             std::optional<std::string> c = readContent(path);
+#if LLVM_VERSION_MAJOR >= 13
+             auto buf = MemoryBuffer::getFile(path + ".blob", /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false);
+#else
+             auto buf = MemoryBuffer::getFile(path + ".blob", /*FileSize=*/-1,
+                                              /*RequiresNullTerminator=*/false);
+#endif
+             if (c && buf)
+               bytes += c->size() + (*buf)->getBufferSize();
+           }
+         }),
+         n);
+
+  std::string pack_path = root + "/cache.pack";
+  {
+    PackStore pack;
+    report("pack: write", wallTime([&] {
+             pack.open(pack_path);
+             for (auto &path : paths)
+               pack.put(path, content, blob);
+             pack.close();
+           }),
+           n);
+  }
+  {
+    PackStore pack;
+    report("pack: open (footer)", wallTime([&] { pack.open(pack_path); }), 1);
+    report("pack: read", wallTime([&] {
+             std::string c;
+             std::unique_ptr<MemoryBuffer> buf;
+             for (auto &path : paths)
+               if (pack.load(path, c, buf))
+                 bytes += c.size() + buf->getBufferSize();
+           }),
+           n);
+  }
+  if (bytes != 2 * size_t(n) * (content.size() + blob.size()))
+    fprintf(stderr, "  read %zu bytes, expected %zu\n", bytes, 2 * size_t(n) * (content.size() + blob.size()));
+  sys::fs::remove_directories(root);
+}
+
+Register reg("pack", "PackStore vs. two files per source in a directory tree (cache.pack vs. hierarchicalPath)",
+             run);
+} // namespace
+} // namespace ccls::bench
@@ -0,0 +1,139 @@
+// Copyright 2017-2018 ccls Authors
+// SPDX-License-Identifier: Apache-2.0
+
+#include "bench.hh"
+
+#include "config.hh"
+#include "query.hh"
+#include "serializer.hh"
+#include "utils.hh"
+
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdio.h>
+
+using namespace llvm;
+
+namespace ccls::bench {
+namespace {
+cl::opt<std::string> opt_cache("uses-cache",
+                               cl::desc("uses: .ccls-cache directory to load the DB from (default: synthetic)"));
+cl::opt<int> opt_entities("uses-entities", cl::desc("uses: entities of the synthetic DB"), cl::init(200000));
+cl::opt<int> opt_files("uses-files", cl::desc("uses: files of the synthetic DB"), cl::init(5000));
+
+// Load every .blob/.json under |dir| into a DB and return the uses of each
+// entity.
+std::vector<std::vector<Use>> loadCache(const std::string &dir) {
+  Config config;
+  g_config = &config;
+  DB db;
+  std::error_code ec;
+  int files = 0;
+  for (sys::fs::recursive_directory_iterator it(dir, ec), end; it != end && !ec; it.increment(ec)) {
+    StringRef path = it->path();
+    SerializeFormat format;
+    if (path.endswith(".blob"))
+      format = SerializeFormat::Binary;
+    else if (path.endswith(".json"))
+      format = SerializeFormat::Json;
+    else
+      continue;
+    auto buf = MemoryBuffer::getFile(path);
+    if (!buf)
+      continue;
+    StringRef serialized = (*buf)->getBuffer();
+    std::unique_ptr<IndexFile> file = deserialize(format, path.drop_back(5).str(),
+                                                  {serialized.data(), serialized.size()}, "", std::nullopt);
+    if (!file)
+      continue;
+    IndexUpdate update = IndexUpdate::createDelta(nullptr, file.get());
+    db.applyIndexUpdate(&update);
+    files++;
+  }
+  printf("  %d indexes from %s\n", files, dir.c_str());
+
+  std::vector<std::vector<Use>> ret;
+  auto collect = [&](auto &entities) {
+    for (auto &e : entities)
+      if (e.uses.size())
+        ret.emplace_back(e.uses.begin(), e.uses.end());
+  };
+  collect(db.funcs);
+  collect(db.types);
+  collect(db.vars);
+  g_config = nullptr;
+  return ret;
+}
+
+// Heavy-tailed uses per entity over a few files each, with ranges about as wide
+// as an identifier, mostly plain references. Lines are uniform within a file,
+// which is pessimistic for the delta encoding.
+std::vector<std::vector<Use>> synthesize(int entities, int files) {
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<double> unit(0, 1);
+  const Role roles[] = {Role::Reference, Role::Reference, Role::Reference, Role::Call,
+                        Role::Read,      Role::Write,     Role::Dynamic | Role::Call};
+  std::vector<std::vector<Use>> ret(entities);
+  for (auto &uses : ret) {
+    int n = std::min(20000, int(1 / std::pow(unit(rng) + 1e-6, 1.3)));
+    std::vector<int> file_ids(std::max(1, std::min(n, 1 + int(rng() % 8))));
+    for (int &file_id : file_ids)
+      file_id = rng() % files;
+    int width = 3 + rng() % 18;
+    for (int i = 0; i < n; i++) {
+      Use use;
+      use.file_id = file_ids[rng() % file_ids.size()];
+      uint16_t line = rng() % 3000;
+      int16_t column = rng() % 80;
+      use.range = {{line, column}, {line, int16_t(column + width)}};
+      use.role = roles[rng() % std::size(roles)];
+      uses.push_back(use);
+    }
+  }
+  return ret;
+}
+
+void run() {
+  std::vector<std::vector<Use>> all =
+      opt_cache.empty() ? synthesize(opt_entities, opt_files) : loadCache(opt_cache);
+  size_t total = 0;
+  for (auto &uses : all)
+    total += uses.size();
+  printf("  %zu entities with uses, %zu uses\n", all.size(), total);
+  if (!total)
+    return;
+
+  for (bool compress : {false, true}) {
+    std::vector<UseList> lists(all.size());
+    std::vector<Use> none, add;
+    std::string label = compress ? "packed" : "plain";
+    report(label + ": fill", wallTime([&] {
+             for (size_t i = 0; i < all.size(); i++) {
+               add = all[i];
+               lists[i].splice(none, add, compress);
+             }
+           }),
+           total);
+    size_t checksum = 0;
+    report(label + ": iterate", wallTime([&] {
+             for (auto &list : lists)
+               for (const Use &use : list)
+                 checksum += use.range.start.line;
+           }),
+           total);
+    size_t bytes = lists.size() * sizeof(UseList);
+    for (auto &list : lists)
+      bytes += list.heapBytes();
+    printf("  %-36s %10zu bytes %10.2f bytes/use (checksum %zu)\n", (label + ": memory").c_str(), bytes,
+           double(bytes) / total, checksum);
+  }
+}
+
+Register reg("uses", "memory and iteration of UseList, packed vs. plain (index.compressUses)", run);
+} // namespace
+} // namespace ccls::bench
@@ -0,0 +1,72 @@
+// Copyright 2017-2018 ccls Authors
+// SPDX-License-Identifier: Apache-2.0
+
+#include "bench.hh"
+
+#include "fuzzy_match.hh"
+#include "query.hh"
+#include "utils.hh"
+
+#include <llvm/Support/CommandLine.h>
+
+#include <algorithm>
+#include <stdio.h>
+
+using namespace llvm;
+
+namespace ccls::bench {
+namespace {
+cl::opt<int> opt_entities("symbol-entities", cl::desc("symbol: number of entities in the DB"), cl::init(1000000));
+cl::opt<int> opt_max("symbol-max", cl::desc("symbol: workspaceSymbol.maxNum"), cl::init(1000));
+
+constexpr double kTargetMs = 10;
+
+// The scan and sort of workspace/symbol over DB::Columns, without the
+// location lookup of each candidate. Returns the number of results.
+size_t search(const DB::Columns &cols, std::string_view query, bool use_mask) {
+  uint64_t mask = use_mask ? charMask(query) : 0;
+  std::vector<std::pair<int, int>> cands;
+  for (size_t i = 0; i < cols.usr.size() && cands.size() < size_t(opt_max); i++)
+    if ((cols.name_mask[i] & mask) == mask && reverseSubseqMatch(query, cols.name[i].name(true), 1) >= 0)
+      cands.emplace_back(0, int(i));
+  FuzzyMatcher fuzzy(query, 1);
+  for (auto &cand : cands)
+    cand.first = fuzzy.match(cols.name[cand.second].name(true), false);
+  std::sort(cands.begin(), cands.end(), [](const auto &l, const auto &r) { return l.first > r.first; });
+  return cands.size();
+}
+
+void run() {
+  std::vector<std::string> names = makeCandidates(opt_entities);
+  std::vector<std::string> detailed(names.size());
+  DB::Columns cols;
+  cols.reserve(names.size());
+  for (size_t i = 0; i < names.size(); i++) {
+    // "void ccls::getIndex(int)": the qualified name follows the return type.
+    detailed[i] = "void " + names[i] + "(int)";
+    int idx = cols.add(i + 1);
+    DB::Columns::Name &name = cols.name[idx];
+    name.detailed_name = detailed[i].c_str();
+    name.qual_name_offset = 5;
+    size_t colon = names[i].rfind(':');
+    name.short_name_offset = int16_t(5 + (colon == std::string::npos ? 0 : colon + 1));
+    name.short_name_size = int16_t(5 + names[i].size() - name.short_name_offset);
+    cols.name_mask[idx] = charMask(detailed[i]);
+  }
+  printf("  %zu entities, maxNum %d, target %.0f ms per query\n", names.size(), int(opt_max), kTargetMs);
+
+  // Frequent subsequences stop at maxNum early, rare ones scan every entity.
+  static const char *const queries[] = {"gs", "index", "qSym", "upd_path", "SCORE", "mtch", "zzq", "bufTokNode9"};
+  for (const char *query : queries)
+    for (bool use_mask : {false, true}) {
+      size_t results = 0;
+      double t = wallTime([&] { results = search(cols, query, use_mask); });
+      report(std::string(use_mask ? "mask" : "no mask") + " \"" + query + "\" (" + std::to_string(results) +
+                 (t * 1000 <= kTargetMs ? ")" : ", over target)"),
+             t, 1);
+    }
+}
+
+Register reg("symbol", "workspace/symbol scan of DB::Columns with and without the name mask", run);
+} // namespace
+} // namespace ccls::bench
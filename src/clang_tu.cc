@@ -18,7 +18,14 @@
 #else
 #include <llvm/Support/Host.h>
 #endif
+#include <llvm/ADT/StringMap.h>
 #include <llvm/Support/Path.h>
+#include <llvm/Support/VirtualFileSystem.h>
+
+#include <list>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
 
 using namespace clang;
 
@@ -100,8 +107,169 @@ Range fromTokenRangeDefaulted(const SourceManager &sm, const LangOptions &lang,
   return range;
 }
 
-std::unique_ptr<CompilerInvocation> buildCompilerInvocation(const std::string &main, std::vector<const char *> args,
-                                                            IntrusiveRefCntPtr<llvm::vfs::FileSystem> vfs) {
+namespace {
+// Statuses, including failed lookups, and contents of files, keyed by the path
+// without "." components. ".." is kept, as it may follow a symlink. Opening a
+// file whose status is cached does not touch the file system. An entry is
+// dropped by invalidateFileCache, which pipeline calls when a file is
+// (re)indexed or VFS::stamp sees a newer modification time, and the whole
+// cache by clearFileCache when indexing is idle.
+struct FileCache {
+  struct Entry {
+    llvm::sys::TimePoint<> mtime;
+    uint64_t size;
+    std::shared_ptr<const std::string> content;
+  };
+  // A failed lookup has |ec| set.
+  struct StatEntry {
+    std::error_code ec;
+    llvm::vfs::Status st;
+  };
+  // Files larger than this are not cached. The cache stops growing at
+  // kMaxBytes or kMaxStats until it is cleared.
+  static const uint64_t kMaxFileSize = 4 << 20, kMaxBytes = uint64_t(512) << 20;
+  static const size_t kMaxStats = 1 << 20;
+
+  std::shared_mutex mutex;
+  llvm::StringMap<Entry> entries;
+  llvm::StringMap<StatEntry> stats;
+  // Bytes of the contents and the keys.
+  uint64_t bytes = 0;
+
+  void setStatus(StringRef key, const llvm::ErrorOr<llvm::vfs::Status> &st) {
+    // Errors other than a missing file, e.g. EMFILE, may be transient.
+    if (!st && st.getError() != std::errc::no_such_file_or_directory)
+      return;
+    std::lock_guard lock(mutex);
+    if (stats.size() < kMaxStats || stats.count(key))
+      stats[key] = st ? StatEntry{{}, *st} : StatEntry{st.getError(), {}};
+  }
+} file_cache;
+
+std::string fileCacheKey(const Twine &path) {
+  SmallString<256> key;
+  path.toVector(key);
+  llvm::sys::path::remove_dots(key, false);
+  return std::string(key);
+}
+
+class SharedBuffer : public llvm::MemoryBuffer {
+  std::shared_ptr<const std::string> content;
+  std::string name;
+
+public:
+  SharedBuffer(std::shared_ptr<const std::string> content, std::string name)
+      : content(std::move(content)), name(std::move(name)) {
+    init(this->content->data(), this->content->data() + this->content->size(), true);
+  }
+  BufferKind getBufferKind() const override { return MemoryBuffer_Malloc; }
+  StringRef getBufferIdentifier() const override { return name; }
+};
+
+class CachedFile : public llvm::vfs::File {
+  llvm::vfs::Status st;
+  std::shared_ptr<const std::string> content;
+
+public:
+  CachedFile(llvm::vfs::Status st, std::shared_ptr<const std::string> content)
+      : st(std::move(st)), content(std::move(content)) {}
+  llvm::ErrorOr<llvm::vfs::Status> status() override { return st; }
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> getBuffer(const Twine &name, int64_t, bool, bool) override {
+    return std::make_unique<SharedBuffer>(content, name.str());
+  }
+  std::error_code close() override { return {}; }
+};
+
+class CachingFileSystem : public llvm::vfs::ProxyFileSystem {
+public:
+  CachingFileSystem() : ProxyFileSystem(llvm::vfs::getRealFileSystem()) {}
+
+  llvm::ErrorOr<llvm::vfs::Status> status(const Twine &path) override {
+    std::string key = fileCacheKey(path);
+    {
+      std::shared_lock lock(file_cache.mutex);
+      auto it = file_cache.stats.find(key);
+      if (it != file_cache.stats.end()) {
+        if (it->second.ec)
+          return it->second.ec;
+        return llvm::vfs::Status::copyWithNewName(it->second.st, path.str());
+      }
+    }
+    auto st = getUnderlyingFS().status(path);
+    file_cache.setStatus(key, st);
+    return st;
+  }
+
+  llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>> openFileForRead(const Twine &path) override {
+    std::string key = fileCacheKey(path);
+    {
+      std::shared_lock lock(file_cache.mutex);
+      auto s = file_cache.stats.find(key);
+      if (s != file_cache.stats.end()) {
+        if (s->second.ec)
+          return s->second.ec;
+        const llvm::vfs::Status &st = s->second.st;
+        auto it = file_cache.entries.find(key);
+        if (it != file_cache.entries.end() && it->second.mtime == st.getLastModificationTime() &&
+            it->second.size == st.getSize())
+          return std::make_unique<CachedFile>(llvm::vfs::Status::copyWithNewName(st, path.str()),
+                                              it->second.content);
+      }
+    }
+    auto file = getUnderlyingFS().openFileForRead(path);
+    if (!file) {
+      file_cache.setStatus(key, file.getError());
+      return file;
+    }
+    auto st = (*file)->status();
+    file_cache.setStatus(key, st);
+    if (!st || st->getSize() > FileCache::kMaxFileSize)
+      return file;
+    auto buf = (*file)->getBuffer(path, st->getSize(), false, false);
+    if (!buf)
+      return file;
+    auto content = std::make_shared<const std::string>((*buf)->getBuffer());
+    std::lock_guard lock(file_cache.mutex);
+    auto [it, inserted] = file_cache.entries.try_emplace(key);
+    if (!inserted)
+      file_cache.bytes -= key.size() + it->second.content->size();
+    if (file_cache.bytes + key.size() + content->size() <= FileCache::kMaxBytes) {
+      file_cache.bytes += key.size() + content->size();
+      it->second = {st->getLastModificationTime(), st->getSize(), content};
+    } else {
+      file_cache.entries.erase(it);
+    }
+    return std::make_unique<CachedFile>(*st, std::move(content));
+  }
+};
+} // namespace
+
+llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> getCachingFileSystem() {
+  static llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs(new CachingFileSystem);
+  return fs;
+}
+
+void invalidateFileCache(const std::string &path) {
+  std::string key = fileCacheKey(path);
+  std::lock_guard lock(file_cache.mutex);
+  file_cache.stats.erase(key);
+  auto it = file_cache.entries.find(key);
+  if (it == file_cache.entries.end())
+    return;
+  file_cache.bytes -= key.size() + it->second.content->size();
+  file_cache.entries.erase(it);
+}
+
+void clearFileCache() {
+  std::lock_guard lock(file_cache.mutex);
+  file_cache.entries.clear();
+  file_cache.stats.clear();
+  file_cache.bytes = 0;
+}
+
+namespace {
+std::unique_ptr<CompilerInvocation> buildInvocation(std::vector<const char *> args,
+                                                    IntrusiveRefCntPtr<llvm::vfs::FileSystem> vfs) {
   std::string save = "-resource-dir=" + g_config->clang.resourceDir;
   args.push_back(save.c_str());
   args.push_back("-fsyntax-only");
@@ -182,9 +350,6 @@ std::unique_ptr<CompilerInvocation> buildCompilerInvocation(const std::string &m
   ci->getLangOpts()->RecoveryASTType = true;
 #endif
 #endif
-  auto &isec = ci->getFrontendOpts().Inputs;
-  if (isec.size())
-    isec[0] = FrontendInputFile(main, isec[0].getKind(), isec[0].isSystem());
   ci->getPreprocessorOpts().DisablePragmaDebugCrash = true;
   // clangSerialization has an unstable format. Disable PCH reading/writing
   // to work around PCH mismatch problems.
@@ -193,6 +358,77 @@ std::unique_ptr<CompilerInvocation> buildCompilerInvocation(const std::string &m
   ci->getPreprocessorOpts().PCHThroughHeader.clear();
 
   ci->getHeaderSearchOpts().ModuleFormat = "raw";
+  // -M* are not part of the cache key. Never write dependency files.
+  ci->getDependencyOutputOpts() = DependencyOutputOptions();
+  return ci;
+}
+
+// Most TUs share a few distinct sets of flags. Cache the invocations (most
+// recently used first) by compileArgsKey, to skip the driver and its toolchain
+// detection.
+const size_t kMaxInvocations = 128;
+std::mutex invocations_mutex;
+std::list<std::pair<std::string, std::shared_ptr<const CompilerInvocation>>> invocations;
+std::unordered_map<std::string, decltype(invocations)::iterator> key2invocation;
+} // namespace
+
+std::string compileArgsKey(const std::string &main, const std::vector<const char *> &args) {
+  StringRef filename = llvm::sys::path::filename(main);
+  std::string key;
+  bool found = false;
+  for (size_t i = 0; i < args.size(); i++) {
+    StringRef arg = args[i];
+    if (arg == "-o" || arg == "-MF" || arg == "-MT" || arg == "-MQ") {
+      i++;
+      continue;
+    }
+    if (arg.startswith("-M"))
+      continue;
+    if (i && !arg.startswith("-") && llvm::sys::path::filename(arg) == filename) {
+      arg = llvm::sys::path::extension(filename);
+      found = true;
+    }
+    key += arg;
+    key += '\0';
+  }
+  return found ? key : std::string();
+}
+
+std::unique_ptr<CompilerInvocation> buildCompilerInvocation(const std::string &main, std::vector<const char *> args,
+                                                            IntrusiveRefCntPtr<llvm::vfs::FileSystem> vfs) {
+  std::string key = compileArgsKey(main, args);
+  std::shared_ptr<const CompilerInvocation> cached;
+  if (key.size()) {
+    std::lock_guard lock(invocations_mutex);
+    auto it = key2invocation.find(key);
+    if (it != key2invocation.end()) {
+      invocations.splice(invocations.begin(), invocations, it->second);
+      cached = it->second->second;
+    }
+  }
+  if (!cached) {
+    cached = buildInvocation(std::move(args), vfs);
+    if (!cached)
+      return nullptr;
+    if (key.size()) {
+      std::lock_guard lock(invocations_mutex);
+      auto [it, inserted] = key2invocation.try_emplace(key);
+      if (inserted) {
+        invocations.emplace_front(std::move(key), cached);
+        it->second = invocations.begin();
+        if (invocations.size() > kMaxInvocations) {
+          key2invocation.erase(invocations.back().first);
+          invocations.pop_back();
+        }
+      }
+    }
+  }
+
+  auto ci = std::make_unique<CompilerInvocation>(*cached);
+  auto &isec = ci->getFrontendOpts().Inputs;
+  if (isec.size())
+    isec[0] = FrontendInputFile(main, isec[0].getKind(), isec[0].isSystem());
+  ci->getCodeGenOpts().MainFileName = llvm::sys::path::filename(main).str();
   return ci;
 }
 
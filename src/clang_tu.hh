@@ -37,6 +37,21 @@ Range fromTokenRange(const clang::SourceManager &sm, const clang::LangOptions &l
 Range fromTokenRangeDefaulted(const clang::SourceManager &sm, const clang::LangOptions &lang, clang::SourceRange sr,
                               clang::FileID fid, Range range);
 
+// A process-wide file system caching the status (including failed lookups) and
+// content of files, shared by indexer and sema threads. Cached entries are used
+// without checking the file system. invalidateFileCache drops one path, e.g.
+// when it is saved, reported by workspace/didChangeWatchedFiles or seen with a
+// newer modification time by VFS::stamp.
+llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> getCachingFileSystem();
+void invalidateFileCache(const std::string &path);
+void clearFileCache();
+
+// Return |args| joined by '\0' with |main| replaced by its extension and without
+// the flags naming outputs (-o, -MF, -MT, -MQ and the other -M* dependency
+// flags), or an empty string if |main| is not in |args|. Keys the caches of
+// compiler invocations and preambles.
+std::string compileArgsKey(const std::string &main, const std::vector<const char *> &args);
+
 std::unique_ptr<clang::CompilerInvocation> buildCompilerInvocation(const std::string &main,
                                                                    std::vector<const char *> args,
                                                                    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> VFS);
@@ -54,6 +54,13 @@ struct Config {
     // conflicting cache files for system headers.
     bool hierarchicalPath = false;
 
+    // If true, store the cache of all files in a single append-only file
+    // $directory/ccls.pack instead of two files per source. This avoids many
+    // open/stat calls on slow (e.g. network) file systems. The pack is
+    // compacted on startup when most of it is superseded. It must not be shared
+    // by concurrent ccls processes.
+    bool pack = false;
+
     // After this number of loads, keep a copy of file index in memory (which
     // increases memory usage). During incremental updates, the index subtracted
     // will come from the in-memory copy, instead of the on-disk file.
@@ -258,6 +265,11 @@ struct Config {
     // - https://github.com/autozimu/LanguageClient-neovim/issues/224
     int comments = 2;
 
+    // If true, the uses of each symbol are kept in memory as varint-encoded
+    // deltas, which takes a fraction of the memory at the cost of decoding
+    // them on each access.
+    bool compressUses = false;
+
     // If false, names of no linkage are not indexed in the background. They are
     // indexed after the files are opened.
     bool initialNoLinkage = false;
@@ -292,9 +304,23 @@ struct Config {
     // If true, index parameters in declarations.
     bool parametersInDeclarations = true;
 
+    // If positive, each indexer thread keeps up to this many in-memory
+    // preambles, keyed by the compiler arguments, the directory and the
+    // preamble (leading #include lines) of the main file. During the initial
+    // indexing, a TU whose preamble has been seen before reuses or builds one
+    // if the headers in it have been indexed by other TUs. Reindexing never
+    // uses one. Ignored if multiVersion != 0.
+    int preambleCache = 0;
+
     // Number of indexer threads. If 0, 80% of cores are used.
     int threads = 0;
 
+    // Number of threads loading index files from the cache during the initial
+    // load. Files whose cache is stale are forwarded to indexer threads. If 0,
+    // use the number of indexer threads. If negative, indexer threads load the
+    // cache.
+    int loaderThreads = 0;
+
     // Whether to reparse a file if write times of its dependencies have
     // changed. The file will always be reparsed if its own write time changes.
     // 0: no, 1: only during initial load of project, 2: yes
@@ -307,6 +333,11 @@ struct Config {
     // If the document of a request has not been indexed, wait up to this many
     // milleseconds before reporting error.
     int64_t timeout = 5000;
+
+    // Number of threads running read-only requests (e.g. textDocument/hover,
+    // workspace/symbol) concurrently, so that a slow request does not block
+    // others. If 0, all requests run on the main thread.
+    int threads = 2;
   } request;
 
   struct Session {
@@ -328,7 +359,7 @@ struct Config {
     int maxNum = 2000;
   } xref;
 };
-REFLECT_STRUCT(Config::Cache, directory, format, hierarchicalPath, retainInMemory);
+REFLECT_STRUCT(Config::Cache, directory, format, hierarchicalPath, pack, retainInMemory);
 REFLECT_STRUCT(Config::ServerCap::DocumentOnTypeFormattingOptions, firstTriggerCharacter, moreTriggerCharacter);
 REFLECT_STRUCT(Config::ServerCap::Workspace::WorkspaceFolders, supported, changeNotifications);
 REFLECT_STRUCT(Config::ServerCap::Workspace, workspaceFolders);
@@ -343,10 +374,11 @@ REFLECT_STRUCT(Config::Completion, caseSensitivity, detailedLabel, dropOldReques
 REFLECT_STRUCT(Config::Diagnostics, blacklist, onChange, onOpen, onSave, spellChecking, whitelist)
 REFLECT_STRUCT(Config::Highlight, largeFileSize, rainbow, blacklist, whitelist)
 REFLECT_STRUCT(Config::Index::Name, suppressUnwrittenScope);
-REFLECT_STRUCT(Config::Index, blacklist, comments, initialNoLinkage, initialBlacklist, initialWhitelist,
-               maxInitializerLines, multiVersion, multiVersionBlacklist, multiVersionWhitelist, name, onChange,
-               parametersInDeclarations, threads, trackDependency, whitelist);
-REFLECT_STRUCT(Config::Request, timeout);
+REFLECT_STRUCT(Config::Index, blacklist, comments, compressUses, initialNoLinkage, initialBlacklist,
+               initialWhitelist, loaderThreads, maxInitializerLines, multiVersion, multiVersionBlacklist,
+               multiVersionWhitelist, name, onChange, parametersInDeclarations, preambleCache, threads,
+               trackDependency, whitelist);
+REFLECT_STRUCT(Config::Request, threads, timeout);
 REFLECT_STRUCT(Config::Session, maxNum);
 REFLECT_STRUCT(Config::WorkspaceSymbol, caseSensitivity, maxNum, sort);
 REFLECT_STRUCT(Config::Xref, maxNum);
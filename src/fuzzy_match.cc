@@ -4,7 +4,6 @@
 #include "fuzzy_match.hh"
 
 #include <algorithm>
-#include <ctype.h>
 #include <stdio.h>
 #include <vector>
 
@@ -13,38 +12,82 @@ namespace {
 enum CharClass { Other, Lower, Upper };
 enum CharRole { None, Tail, Head };
 
-CharClass getCharClass(int c) {
-  if (islower(c))
-    return Lower;
-  if (isupper(c))
-    return Upper;
-  return Other;
+// Branchless so that the per-character loops below can be auto-vectorized.
+constexpr int charClass(uint8_t c) { return (uint8_t(c - 'a') < 26) * Lower | (uint8_t(c - 'A') < 26) * Upper; }
+char toLower(char c) { return char(uint8_t(c) + (uint8_t(c - 'A') < 26 ? 'a' - 'A' : 0)); }
+
+constexpr int charRole(int pre, int cur, int suc) {
+  // U(U)L is Head while U(U)U is Tail
+  int head = (pre == Other) | ((cur == Upper) & ((pre == Lower) | (suc == Lower)));
+  return cur == Other ? None : Tail + head;
 }
 
+// Lookup tables for the scalar loops. bit maps a case-folded character to its
+// bit in the masks: letters use 0..25 and digits 26..35. Other characters
+// share 36..63.
+struct CharTable {
+  uint8_t cls[256];
+  uint8_t bit[256];
+  uint8_t role[27];
+  constexpr CharTable() : cls(), bit(), role() {
+    for (int c = 0; c < 256; c++) {
+      cls[c] = uint8_t(charClass(uint8_t(c)));
+      bit[c] = uint8_t('a' <= c && c <= 'z' ? c - 'a' : '0' <= c && c <= '9' ? 26 + c - '0' : 36 + c % 28);
+    }
+    for (int i = 0; i < 27; i++)
+      role[i] = uint8_t(charRole(i / 9, i / 3 % 3, i % 3));
+  }
+};
+constexpr CharTable kTable;
+
+int getCharClass(char c) { return kTable.cls[uint8_t(c)]; }
+uint64_t charBit(char c) { return uint64_t(1) << kTable.bit[uint8_t(c)]; }
+
+// Below this length the scalar loop is faster than the vectorized one.
+constexpr int kVectorRoles = 32;
+
 void calculateRoles(std::string_view s, int roles[], int *class_set) {
-  if (s.empty()) {
+  int n = int(s.size()), set = 0;
+  if (n == 0) {
     *class_set = 0;
     return;
   }
-  CharClass pre = Other, cur = getCharClass(s[0]), suc;
-  *class_set = 1 << cur;
-  auto fn = [&]() {
-    if (cur == Other)
-      return None;
-    // U(U)L is Head while U(U)U is Tail
-    return pre == Other || (cur == Upper && (pre == Lower || suc == Lower)) ? Head : Tail;
-  };
-  for (size_t i = 0; i < s.size() - 1; i++) {
-    suc = getCharClass(s[i + 1]);
-    *class_set |= 1 << suc;
-    roles[i] = fn();
-    pre = cur;
-    cur = suc;
+  if (n < kVectorRoles) {
+    int pre = Other, cur = getCharClass(s[0]);
+    set = 1 << cur;
+    for (int i = 0; i < n - 1; i++) {
+      int suc = getCharClass(s[i + 1]);
+      set |= 1 << suc;
+      roles[i] = kTable.role[pre * 9 + cur * 3 + suc];
+      pre = cur;
+      cur = suc;
+    }
+    roles[n - 1] = kTable.role[pre * 9 + cur * 3 + Other];
+  } else {
+    // Classes of s padded with Other on both sides. Roles then depend only on
+    // the neighbors, without a loop-carried dependency.
+    constexpr int kMax = std::max(FuzzyMatcher::kMaxPat, FuzzyMatcher::kMaxText);
+    uint8_t cls[kMax + 2];
+    n = std::min(n, kMax);
+    cls[0] = cls[n + 1] = Other;
+    for (int i = 0; i < n; i++) {
+      cls[i + 1] = uint8_t(charClass(uint8_t(s[i])));
+      set |= cls[i + 1] + 1 + (cls[i + 1] == Upper); // 1 << cls[i + 1]
+    }
+    for (int i = 0; i < n; i++)
+      roles[i] = charRole(cls[i], cls[i + 1], cls[i + 2]);
   }
-  roles[s.size() - 1] = fn();
+  *class_set = set;
 }
 } // namespace
 
+uint64_t charMask(std::string_view s) {
+  uint64_t mask = 0;
+  for (char c : s)
+    mask |= charBit(toLower(c));
+  return mask;
+}
+
 int FuzzyMatcher::missScore(int j, bool last) {
   int s = -3;
   if (last)
@@ -87,7 +130,8 @@ FuzzyMatcher::FuzzyMatcher(std::string_view pattern, int sensitivity) {
   for (size_t i = 0; i < pattern.size(); i++)
     if (pattern[i] != ' ') {
       pat += pattern[i];
-      low_pat[n] = (char)::tolower(pattern[i]);
+      low_pat[n] = toLower(pattern[i]);
+      pat_mask |= charBit(low_pat[n]);
       pat_role[n] = pat_role[i];
       n++;
     }
@@ -100,8 +144,15 @@ int FuzzyMatcher::match(std::string_view text, bool strict) {
   if (n > kMaxText)
     return kMinScore + 1;
   this->text = text;
+  uint64_t text_mask = 0;
+  for (int i = 0; i < n; i++)
+    low_text[i] = toLower(text[i]);
   for (int i = 0; i < n; i++)
-    low_text[i] = (char)::tolower(text[i]);
+    text_mask |= charBit(low_text[i]);
+  // Every character of pat must be matched (case-insensitively at least), so
+  // the DP cannot find a match.
+  if (pat_mask & ~text_mask)
+    return kMinScore;
   calculateRoles(text, text_role, &text_set);
   if (strict && n && !!pat_role[0] != !!text_role[0])
     return kMinScore;
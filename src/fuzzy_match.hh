@@ -4,10 +4,16 @@
 #pragma once
 
 #include <limits.h>
+#include <stdint.h>
 #include <string>
 #include <string_view>
 
 namespace ccls {
+// Returns a bit set of the case-folded characters of |s|, with the bits that
+// FuzzyMatcher uses to reject a text before the DP: a text can only match a
+// pattern if its mask covers the pattern's.
+uint64_t charMask(std::string_view s);
+
 class FuzzyMatcher {
 public:
   constexpr static int kMaxPat = 100;
@@ -24,6 +30,9 @@ private:
   std::string pat;
   std::string_view text;
   int pat_set, text_set;
+  // Case-folded characters of pat. A text missing any of them is rejected
+  // before the DP.
+  uint64_t pat_mask = 0;
   char low_pat[kMaxPat], low_text[kMaxText];
   int pat_role[kMaxPat], text_role[kMaxText];
   int dp[2][kMaxText + 1][2];
@@ -13,6 +13,7 @@
 #include <clang/Basic/TargetInfo.h>
 #include <clang/Frontend/FrontendAction.h>
 #include <clang/Frontend/MultiplexConsumer.h>
+#include <clang/Frontend/PrecompiledPreamble.h>
 #include <clang/Index/IndexDataConsumer.h>
 #include <clang/Index/IndexingAction.h>
 #include <clang/Index/USRGeneration.h>
@@ -23,6 +24,7 @@
 
 #include <algorithm>
 #include <inttypes.h>
+#include <list>
 #include <map>
 #include <unordered_set>
 
@@ -81,8 +83,8 @@ struct IndexParam {
       if (!it->second.mtime)
         if (auto tim = lastWriteTime(path))
           it->second.mtime = *tim;
-      if (std::optional<std::string> content = readContent(path))
-        it->second.content = *content;
+      // The buffer parsed by clang, read through the caching file system.
+      it->second.content = ctx->getSourceManager().getBufferData(fid).str();
 
       if (!vfs.stamp(path, it->second.mtime, no_linkage ? 3 : 1))
         return;
@@ -574,7 +576,7 @@ public:
         break;
     }
     def.qual_name_offset = i;
-    def.detailed_name = intern(name);
+    def.detailed_name = internReclaimable(name);
   }
 
   void setVarName(const Decl *d, std::string_view short_name, std::string_view qualified, IndexVar::Def &def) {
@@ -615,7 +617,7 @@ public:
       def.short_name_offset = str.size() + qualified.size() - short_name.size();
       def.short_name_size = short_name.size();
       str += StringRef(qualified.data(), qualified.size());
-      def.detailed_name = intern(str);
+      def.detailed_name = internReclaimable(str);
     } else {
       setName(d, short_name, qualified, def);
     }
@@ -631,8 +633,9 @@ public:
                        ? buf.size() && buf[0] == ':' ? Twine(" ", buf) : Twine(" = ", buf)
                        : Twine();
       Twine t = def.detailed_name + init;
-      def.hover = def.storage == SC_Static && strncmp(def.detailed_name, "static ", 7) ? intern(("static " + t).str())
-                                                                                       : intern(t.str());
+      def.hover = def.storage == SC_Static && strncmp(def.detailed_name, "static ", 7)
+                      ? internReclaimable(("static " + t).str())
+                      : internReclaimable(t.str());
     }
   }
 
@@ -799,7 +802,7 @@ public:
         return;
       }
       if (entity->def.comments[0] == '\0' && g_config->index.comments)
-        entity->def.comments = intern(getComment(origD));
+        entity->def.comments = internReclaimable(getComment(origD));
     };
     switch (kind) {
     case Kind::Invalid:
@@ -838,7 +841,7 @@ public:
         addMacroUse(db, sm, usr, Kind::Type, spell);
       if ((is_def || type->def.detailed_name[0] == '\0') && info->short_name.size()) {
         if (d->getKind() == Decl::TemplateTypeParm)
-          type->def.detailed_name = intern(info->short_name);
+          type->def.detailed_name = internReclaimable(info->short_name);
         else
           // OrigD may be detailed, e.g. "struct D : B {}"
           setName(origD, info->short_name, info->qualified, type->def);
@@ -951,11 +954,11 @@ public:
           if (TypedefNameDecl *td = tag_d->getTypedefNameForAnonDecl()) {
             StringRef name = td->getName();
             std::string detailed = ("anon " + tag + " " + name).str();
-            type->def.detailed_name = intern(detailed);
+            type->def.detailed_name = internReclaimable(detailed);
             type->def.short_name_size = detailed.size();
           } else {
             std::string name = ("anon " + tag).str();
-            type->def.detailed_name = intern(name);
+            type->def.detailed_name = internReclaimable(name);
             type->def.short_name_size = name.size();
           }
         }
@@ -1038,7 +1041,7 @@ public:
         const auto &val = ecd->getInitVal();
         std::string init =
             " = " + (val.isSigned() ? std::to_string(val.getSExtValue()) : std::to_string(val.getZExtValue()));
-        var->def.hover = intern(var->def.detailed_name + init);
+        var->def.hover = internReclaimable(var->def.detailed_name + init);
       }
       break;
     default:
@@ -1113,12 +1116,12 @@ public:
       Range extent = fromTokenRange(sm, param.ctx->getLangOpts(), sr);
       var.def.spell = {Use{{range, Role::Definition}}, extent};
       if (var.def.detailed_name[0] == '\0') {
-        var.def.detailed_name = intern(name);
+        var.def.detailed_name = internReclaimable(name);
         var.def.short_name_size = name.size();
         StringRef buf = getSourceInRange(sm, lang, sr);
-        var.def.hover = intern(buf.count('\n') <= g_config->index.maxInitializerLines - 1
-                                   ? Twine("#define ", getSourceInRange(sm, lang, sr)).str()
-                                   : Twine("#define ", name).str());
+        var.def.hover = internReclaimable(buf.count('\n') <= g_config->index.maxInitializerLines - 1
+                                              ? Twine("#define ", getSourceInRange(sm, lang, sr)).str()
+                                              : Twine("#define ", name).str());
       }
     }
   }
@@ -1187,10 +1190,209 @@ public:
       info.FormatDiagnostic(message);
   }
 };
+
+// A preamble shared by TUs with the same arguments and leading #include lines.
+// |deps| are the files in the preamble, which become dependencies of the TUs
+// reusing it. |includes| and |skipped_ranges| are those of the main file in the
+// preamble region, which the PP callbacks of a TU reusing it do not see.
+struct IndexPreamble {
+  std::string key;
+  PrecompiledPreamble preamble;
+  std::vector<std::pair<std::string, int64_t>> deps;
+  std::vector<IndexInclude> includes;
+  std::vector<Range> skipped_ranges;
+  // Whether the preamble region of the main file defines macros, which would
+  // not be indexed.
+  bool defines_macros = false;
+};
+
+class PreambleDeps : public PreambleCallbacks {
+  class Callbacks : public PPCallbacks {
+    PreambleDeps &out;
+    SourceManager &sm;
+
+  public:
+    Callbacks(PreambleDeps &out, SourceManager &sm) : out(out), sm(sm) {}
+    void FileChanged(SourceLocation sl, FileChangeReason reason, SrcMgr::CharacteristicKind, FileID) override {
+      FileID fid = sm.getFileID(sl);
+      if (reason != FileChangeReason::EnterFile || fid == sm.getMainFileID())
+        return;
+#if LLVM_VERSION_MAJOR < 19
+      if (const FileEntry *fe = sm.getFileEntryForID(fid)) {
+#else
+      if (OptionalFileEntryRef fe = sm.getFileEntryRefForID(fid)) {
+#endif
+        std::string path = pathFromFileEntry(*fe);
+        int64_t mtime = fe->getModificationTime();
+        if (!mtime)
+          mtime = lastWriteTime(path).value_or(0);
+        out.deps.emplace_back(std::move(path), mtime);
+      }
+    }
+    void InclusionDirective(SourceLocation hashLoc, const Token &tok, StringRef included, bool isAngled,
+                            CharSourceRange filenameRange,
+#if LLVM_VERSION_MAJOR >= 16 // llvmorg-16-init-15080-g854c10f8d185
+                            OptionalFileEntryRef fileRef,
+#elif LLVM_VERSION_MAJOR >= 15 // llvmorg-15-init-7692-gd79ad2f1dbc2
+                            llvm::Optional<FileEntryRef> fileRef,
+#else
+                            const FileEntry *file,
+#endif
+                            StringRef searchPath, StringRef relativePath, const clang::Module *suggestedModule,
+#if LLVM_VERSION_MAJOR >= 19 // llvmorg-19-init-1720-gda95d926f6fc
+                            bool moduleImported,
+#endif
+                            SrcMgr::CharacteristicKind fileType) override {
+#if LLVM_VERSION_MAJOR >= 15 // llvmorg-15-init-7692-gd79ad2f1dbc2
+      const FileEntry *file = fileRef ? &fileRef->getFileEntry() : nullptr;
+#endif
+      if (!file || sm.getFileID(filenameRange.getBegin()) != sm.getMainFileID())
+        return;
+#if LLVM_VERSION_MAJOR < 19
+      std::string path = pathFromFileEntry(*file);
+#else
+      std::string path = pathFromFileEntry(*fileRef);
+#endif
+      if (path.size()) {
+        auto spell = fromCharSourceRange(sm, *out.lang, filenameRange, nullptr);
+        out.includes.push_back({spell.start.line, intern(path)});
+      }
+    }
+    void MacroDefined(const Token &, const MacroDirective *md) override {
+      if (sm.isWrittenInMainFile(md->getLocation()))
+        out.defines_macros = true;
+    }
+    void SourceRangeSkipped(SourceRange sr, SourceLocation) override {
+      if (sm.getFileID(sr.getBegin()) == sm.getMainFileID())
+        out.skipped_ranges.push_back(fromCharSourceRange(sm, *out.lang, CharSourceRange::getCharRange(sr)));
+    }
+  };
+
+public:
+  void BeforeExecute(CompilerInstance &ci) override {
+    sm = &ci.getSourceManager();
+    lang = &ci.getLangOpts();
+  }
+  std::unique_ptr<PPCallbacks> createPPCallbacks() override { return std::make_unique<Callbacks>(*this, *sm); }
+  SourceManager *sm = nullptr;
+  const LangOptions *lang = nullptr;
+  std::vector<std::pair<std::string, int64_t>> deps;
+  std::vector<IndexInclude> includes;
+  std::vector<Range> skipped_ranges;
+  bool defines_macros = false;
+};
+
+// Most recently used first.
+thread_local std::list<IndexPreamble> preambles;
+// Hashes of the keys recently indexed from scratch by this thread, most
+// recently used first. A preamble is built when a key is seen again.
+thread_local std::list<size_t> seen_keys;
+
+// Return an empty key if |main| is not in |args|.
+std::string preambleKey(const std::string &main, const std::vector<const char *> &args, StringRef text) {
+  std::string args_key = compileArgsKey(main, args);
+  if (args_key.empty())
+    return args_key;
+  // Quoted includes are resolved relative to the directory of the main file.
+  std::string key(llvm::sys::path::parent_path(main));
+  key += '\0';
+  key += args_key;
+  key += text;
+  return key;
+}
+
+// Whether the files in |preamble| have been claimed by other TUs. Otherwise
+// |main| must be indexed from scratch, so that it indexes them.
+bool preambleOwned(VFS &vfs, const IndexPreamble &preamble, bool no_linkage) {
+  for (auto &[path, mtime] : preamble.deps)
+    if (!vfs.stamped(path, mtime, no_linkage ? 3 : 1))
+      return false;
+  return true;
+}
+
+// Return the preamble to index |main| with, or nullptr to index it from scratch.
+// The first TU with a key on this thread is indexed from scratch. Later TUs with
+// the key reuse a cached preamble or build one, if every file in it has been
+// indexed by another TU.
+IndexPreamble *getPreamble(VFS &vfs, const std::string &main, const std::vector<const char *> &args,
+                           CompilerInvocation &ci, llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs,
+                           std::shared_ptr<PCHContainerOperations> pch, bool no_linkage,
+                           std::unique_ptr<llvm::MemoryBuffer> &buf) {
+  auto file = fs->getBufferForFile(main);
+  if (!file)
+    return nullptr;
+  buf = std::move(*file);
+#if LLVM_VERSION_MAJOR >= 18
+  auto bounds = ComputePreambleBounds(ci.getLangOpts(), *buf, 0);
+#elif LLVM_VERSION_MAJOR >= 12
+  auto bounds = ComputePreambleBounds(*ci.getLangOpts(), *buf, 0);
+#else
+  auto bounds = ComputePreambleBounds(*ci.getLangOpts(), buf.get(), 0);
+#endif
+  if (!bounds.Size)
+    return nullptr;
+  std::string key = preambleKey(main, args, buf->getBuffer().take_front(bounds.Size));
+  if (key.empty())
+    return nullptr;
+  for (auto it = preambles.begin(); it != preambles.end(); ++it)
+    if (it->key == key) {
+#if LLVM_VERSION_MAJOR >= 12
+      if (it->preamble.CanReuse(ci, *buf, bounds, *fs)) {
+#else
+      if (it->preamble.CanReuse(ci, buf.get(), bounds, fs.get())) {
+#endif
+        preambles.splice(preambles.begin(), preambles, it);
+        return preambleOwned(vfs, *it, no_linkage) ? &*it : nullptr;
+      }
+      preambles.erase(it);
+      break;
+    }
+  size_t hash = std::hash<std::string>()(key);
+  auto seen = std::find(seen_keys.begin(), seen_keys.end(), hash);
+  if (seen == seen_keys.end()) {
+    seen_keys.push_front(hash);
+    if (seen_keys.size() > 4 * (size_t)g_config->index.preambleCache)
+      seen_keys.pop_back();
+    return nullptr;
+  }
+  seen_keys.erase(seen);
+
+  IgnoringDiagConsumer dc;
+  IntrusiveRefCntPtr<DiagnosticsEngine> de = CompilerInstance::createDiagnostics(
+#if LLVM_VERSION_MAJOR >= 20
+      *fs,
+#endif
+#if (LLVM_VERSION_MAJOR == 21 && LLVM_VERSION_MINOR >= 1) ||                                                           \
+    (LLVM_VERSION_MAJOR >= 22) // llvmorg-21-init-12923-g13e1a2cb2246
+      ci.getDiagnosticOpts(),
+#else
+      &ci.getDiagnosticOpts(),
+#endif
+      &dc, false);
+  PreambleDeps callbacks;
+  auto preamble = PrecompiledPreamble::Build(ci, buf.get(), bounds,
+#if LLVM_VERSION_MAJOR >= 22 // llvmorg-22-init-2136-gc7f343750744
+                                             de,
+#else
+                                             *de,
+#endif
+                                             fs, pch, true,
+#if LLVM_VERSION_MAJOR >= 17 // llvmorg-17-init-4072-gcc929590ad30
+                                             "",
+#endif
+                                             callbacks);
+  if (!preamble || callbacks.defines_macros)
+    return nullptr;
+  preambles.push_front({std::move(key), std::move(*preamble), std::move(callbacks.deps),
+                        std::move(callbacks.includes), std::move(callbacks.skipped_ranges)});
+  if (preambles.size() > (size_t)g_config->index.preambleCache)
+    preambles.pop_back();
+  return preambleOwned(vfs, preambles.front(), no_linkage) ? &preambles.front() : nullptr;
+}
 } // namespace
 
 const int IndexFile::kMajorVersion = 21;
-const int IndexFile::kMinorVersion = 0;
+const int IndexFile::kMinorVersion = 1;
 
 IndexFile::IndexFile(const std::string &path, const std::string &contents, bool no_linkage)
     : path(path), no_linkage(no_linkage), file_contents(contents) {}
@@ -1234,10 +1436,11 @@ void init() {
 
 IndexResult index(WorkingFiles *wfiles, VFS *vfs, const std::string &opt_wdir, const std::string &main,
                   const std::vector<const char *> &args,
-                  const std::vector<std::pair<std::string, std::string>> &remapped, bool no_linkage, bool &ok) {
+                  const std::vector<std::pair<std::string, std::string>> &remapped, bool no_linkage,
+                  bool use_preamble, bool &ok) {
   ok = true;
   auto pch = std::make_shared<PCHContainerOperations>();
-  llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs = llvm::vfs::getRealFileSystem();
+  llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs = getCachingFileSystem();
   std::shared_ptr<CompilerInvocation> ci = buildCompilerInvocation(main, args, fs);
   // e.g. .s
   if (!ci)
@@ -1259,6 +1462,11 @@ IndexResult index(WorkingFiles *wfiles, VFS *vfs, const std::string &opt_wdir, c
       bufs.push_back(llvm::MemoryBuffer::getMemBuffer(content));
       ci->getPreprocessorOpts().addRemappedFile(filename, bufs.back().get());
     }
+  std::unique_ptr<llvm::MemoryBuffer> main_buf;
+  IndexPreamble *preamble = nullptr;
+  if (use_preamble && g_config->index.preambleCache > 0 && !g_config->index.multiVersion && bufs.empty())
+    if ((preamble = getPreamble(*vfs, main, args, *ci, fs, pch, no_linkage, main_buf)))
+      preamble->preamble.OverridePreamble(*ci, fs, main_buf.get());
 
   IndexDiags dc;
 #if LLVM_VERSION_MAJOR >= 21
@@ -1363,6 +1571,16 @@ IndexResult index(WorkingFiles *wfiles, VFS *vfs, const std::string &opt_wdir, c
       else if (path != entry->import_file)
         entry->dependencies[llvm::CachedHashStringRef(intern(path))] = file.mtime;
     }
+    if (preamble) {
+      for (auto &[path, mtime] : preamble->deps)
+        if (path != entry->path)
+          entry->dependencies.try_emplace(llvm::CachedHashStringRef(intern(path)), mtime);
+      if (entry->path == main) {
+        entry->includes.insert(entry->includes.begin(), preamble->includes.begin(), preamble->includes.end());
+        entry->skipped_ranges.insert(entry->skipped_ranges.begin(), preamble->skipped_ranges.begin(),
+                                     preamble->skipped_ranges.end());
+      }
+    }
     result.indexes.push_back(std::move(entry));
   }
 
@@ -1426,8 +1644,8 @@ void reflect(BinaryReader &vis, SymbolRef &v) {
 }
 void reflect(BinaryReader &vis, Use &v) {
   reflect(vis, v.range);
-  reflect(vis, v.role);
-  reflect(vis, v.file_id);
+  v.role = vis.get<Role>();
+  v.file_id = vis.get<int32_t>();
 }
 void reflect(BinaryReader &vis, DeclRef &v) {
   reflect(vis, static_cast<Use &>(v));
@@ -1442,8 +1660,8 @@ void reflect(BinaryWriter &vis, SymbolRef &v) {
 }
 void reflect(BinaryWriter &vis, Use &v) {
   reflect(vis, v.range);
-  reflect(vis, v.role);
-  reflect(vis, v.file_id);
+  vis.pack(v.role);
+  vis.pack<int32_t>(v.file_id);
 }
 void reflect(BinaryWriter &vis, DeclRef &v) {
   reflect(vis, static_cast<Use &>(v));
@@ -135,7 +135,10 @@ template <typename D> struct NameMixin {
   }
 };
 
-template <template <typename T> class V> struct FuncDef : NameMixin<FuncDef<V>> {
+// |Id| and |Ref| refer to other entities: Usr and SymbolRef in IndexFile, entity
+// indices in the query database.
+template <template <typename T> class V, typename Id = Usr, typename Ref = SymbolRef>
+struct FuncDef : NameMixin<FuncDef<V, Id, Ref>> {
   // General metadata.
   const char *detailed_name = "";
   const char *hover = "";
@@ -143,11 +146,11 @@ template <template <typename T> class V> struct FuncDef : NameMixin<FuncDef<V>>
   Maybe<DeclRef> spell;
 
   // Method this method overrides.
-  V<Usr> bases;
+  V<Id> bases;
   // Local variables or parameters.
-  V<Usr> vars;
+  V<Id> vars;
   // Functions that this function calls.
-  V<SymbolRef> callees;
+  V<Ref> callees;
 
   int file_id = -1; // not serialized
   int16_t qual_name_offset = 0;
@@ -157,8 +160,8 @@ template <template <typename T> class V> struct FuncDef : NameMixin<FuncDef<V>>
   SymbolKind parent_kind = SymbolKind::Unknown;
   uint8_t storage = clang::SC_None;
 
-  const Usr *bases_begin() const { return bases.begin(); }
-  const Usr *bases_end() const { return bases.end(); }
+  const Id *bases_begin() const { return bases.begin(); }
+  const Id *bases_end() const { return bases.end(); }
 };
 REFLECT_STRUCT(FuncDef<VectorAdapter>, detailed_name, hover, comments, spell, bases, vars, callees, qual_name_offset,
                short_name_offset, short_name_size, kind, parent_kind, storage);
@@ -172,17 +175,17 @@ struct IndexFunc : NameMixin<IndexFunc> {
   std::vector<Use> uses;
 };
 
-template <template <typename T> class V> struct TypeDef : NameMixin<TypeDef<V>> {
+template <template <typename T> class V, typename Id = Usr> struct TypeDef : NameMixin<TypeDef<V, Id>> {
   const char *detailed_name = "";
   const char *hover = "";
   const char *comments = "";
   Maybe<DeclRef> spell;
 
-  V<Usr> bases;
+  V<Id> bases;
   // Types, functions, and variables defined in this type.
-  V<Usr> funcs;
-  V<Usr> types;
-  V<std::pair<Usr, int64_t>> vars;
+  V<Id> funcs;
+  V<Id> types;
+  V<std::pair<Id, int64_t>> vars;
 
   // If set, then this is the same underlying type as the given value (ie, this
   // type comes from a using or typedef statement).
@@ -194,8 +197,8 @@ template <template <typename T> class V> struct TypeDef : NameMixin<TypeDef<V>>
   SymbolKind kind = SymbolKind::Unknown;
   SymbolKind parent_kind = SymbolKind::Unknown;
 
-  const Usr *bases_begin() const { return bases.begin(); }
-  const Usr *bases_end() const { return bases.end(); }
+  const Id *bases_begin() const { return bases.begin(); }
+  const Id *bases_end() const { return bases.end(); }
 };
 REFLECT_STRUCT(TypeDef<VectorAdapter>, detailed_name, hover, comments, spell, bases, funcs, types, vars, alias_of,
                qual_name_offset, short_name_offset, short_name_size, kind, parent_kind);
@@ -319,7 +322,8 @@ namespace idx {
 void init();
 IndexResult index(WorkingFiles *wfiles, VFS *vfs, const std::string &opt_wdir, const std::string &file,
                   const std::vector<const char *> &args,
-                  const std::vector<std::pair<std::string, std::string>> &remapped, bool all_linkages, bool &ok);
+                  const std::vector<std::pair<std::string, std::string>> &remapped, bool all_linkages,
+                  bool use_preamble, bool &ok);
 } // namespace idx
 } // namespace ccls
 
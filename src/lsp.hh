@@ -34,6 +34,8 @@ struct InMessage {
   std::unique_ptr<rapidjson::Document> document;
   std::chrono::steady_clock::time_point deadline;
   std::string backlog_path;
+  // The daemon client which has sent the message, or -1.
+  int client = -1;
 };
 
 enum class ErrorCode {
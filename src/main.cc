@@ -41,6 +41,10 @@ opt<int> opt_verbose("v", desc("verbosity, from -3 (fatal) to 2 (verbose)"), ini
 opt<std::string> opt_test_index("test-index", ValueOptional, init("!"), desc("run index tests"), cat(C));
 
 opt<std::string> opt_index("index", desc("standalone mode: index a project and exit"), value_desc("root"), cat(C));
+opt<std::string> opt_daemon("daemon",
+                            desc("daemon mode: serve LSP clients connecting to a Unix domain socket, sharing one "
+                                 "index (e.g. socat - UNIX-CONNECT:<socket> as the client command)"),
+                            value_desc("socket"), cat(C));
 list<std::string> opt_init("init", desc("extra initialization options in JSON"), cat(C));
 opt<std::string> opt_log_file("log-file", desc("stderr or log file"), value_desc("file"), init("stderr"), cat(C));
 opt<bool> opt_log_file_append("log-file-append", desc("append to log file"), cat(C));
@@ -123,10 +127,18 @@ int main(int argc, char **argv) {
       sys::fs::make_absolute(root);
       pipeline::standalone(std::string(root.data(), root.size()));
     } else {
-      // The thread that reads from stdin and dispatchs commands to the main
-      // thread.
-      pipeline::launchStdin();
-      // The thread that writes responses from the main thread to stdout.
+      if (opt_daemon.size()) {
+        // Threads that read from clients and dispatch commands to the main
+        // thread.
+        if (!pipeline::launchDaemon(opt_daemon))
+          return 1;
+      } else {
+        // The thread that reads from stdin and dispatchs commands to the main
+        // thread.
+        pipeline::launchStdin();
+      }
+      // The thread that writes responses from the main thread to stdout or the
+      // clients.
       pipeline::launchStdout();
       // Main thread which also spawns indexer threads upon the "initialize"
       // request.
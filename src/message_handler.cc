@@ -7,6 +7,7 @@
 #include "pipeline.hh"
 #include "project.hh"
 #include "query.hh"
+#include "working_files.hh"
 
 #include <rapidjson/document.h>
 #include <rapidjson/reader.h>
@@ -208,9 +209,22 @@ MessageHandler::MessageHandler() {
   bind("workspace/executeCommand", &MessageHandler::workspace_executeCommand);
   bind("workspace/symbol", &MessageHandler::workspace_symbol);
   // clang-format on
+
+  for (const char *method : {"$ccls/call", "$ccls/inheritance", "$ccls/member", "$ccls/navigate", "$ccls/vars",
+                             "callHierarchy/incomingCalls", "callHierarchy/outgoingCalls",
+                             "textDocument/declaration", "textDocument/definition", "textDocument/documentHighlight",
+                             "textDocument/documentSymbol", "textDocument/foldingRange", "textDocument/hover",
+                             "textDocument/implementation", "textDocument/prepareCallHierarchy",
+                             "textDocument/references", "textDocument/rename", "textDocument/typeDefinition",
+                             "workspace/symbol"})
+    read_only_requests.insert(method);
 }
 
 void MessageHandler::run(InMessage &msg) {
+  struct ClientScope {
+    ClientScope(int client) { WorkingFiles::client = client; }
+    ~ClientScope() { WorkingFiles::client = -1; }
+  } scope(msg.client);
   rapidjson::Document &doc = *msg.document;
   rapidjson::Value null;
   auto it = doc.FindMember("params");
@@ -299,34 +313,44 @@ static std::unordered_map<SymbolIdx, CclsSemanticHighlightSymbol> computeSemanti
   for (auto [sym, refcnt] : file.symbol2refcnt) {
     if (refcnt <= 0)
       continue;
-    std::string_view detailed_name;
-    SymbolKind parent_kind = SymbolKind::Unknown;
-    SymbolKind kind = SymbolKind::Unknown;
-    uint8_t storage = SC_None;
     int idx;
+    const DB::Columns *cols;
     // This switch statement also filters out symbols that are not highlighted.
     switch (sym.kind) {
-    case Kind::Func: {
+    case Kind::Func:
       idx = db->func_usr[sym.usr];
-      const QueryFunc &func = db->funcs[idx];
-      const QueryFunc::Def *def = func.anyDef();
-      if (!def)
-        continue; // applies to for loop
+      cols = &db->funcCols();
+      break;
+    case Kind::Type:
+      idx = db->type_usr[sym.usr];
+      cols = &db->typeCols();
+      break;
+    case Kind::Var:
+      idx = db->var_usr[sym.usr];
+      cols = &db->varCols();
+      break;
+    default:
+      continue; // applies to for loop
+    }
+    SymbolKind kind = cols->kind[idx];
+    uint8_t storage = cols->storage[idx];
+    // The parent of a type or variable is only used if it is defined.
+    SymbolKind parent_kind =
+        sym.kind == Kind::Func || cols->spell_file[idx] >= 0 ? cols->parent_kind[idx] : SymbolKind::Unknown;
+    if (sym.kind == Kind::Func) {
+      if (!*cols->name[idx].detailed_name)
+        continue; // applies to for loop, def is empty
+      std::string_view short_name = cols->name[idx].name(false);
       // Don't highlight overloadable operators or implicit lambda ->
       // std::function constructor.
-      std::string_view short_name = def->name(false);
       if (short_name.compare(0, 8, "operator") == 0)
         continue; // applies to for loop
-      kind = def->kind;
-      storage = def->storage;
-      detailed_name = short_name;
-      parent_kind = def->parent_kind;
 
       // Check whether the function name is actually there.
       // If not, do not publish the semantic highlight.
       // E.g. copy-initialization of constructors should not be highlighted
       // but we still want to keep the range for jumping to definition.
-      std::string_view concise_name = detailed_name.substr(0, detailed_name.find('<'));
+      std::string_view concise_name = short_name.substr(0, short_name.find('<'));
       uint16_t start_line = sym.range.start.line;
       int16_t start_col = sym.range.start.column;
       if (start_line >= wfile->index_lines.size())
@@ -337,37 +361,6 @@ static std::unordered_map<SymbolIdx, CclsSemanticHighlightSymbol> computeSemanti
             line.compare(start_col, concise_name.size(), concise_name) == 0))
         continue;
       sym.range.end.column = start_col + concise_name.size();
-      break;
-    }
-    case Kind::Type: {
-      idx = db->type_usr[sym.usr];
-      const QueryType &type = db->types[idx];
-      for (auto &def : type.def) {
-        kind = def.kind;
-        detailed_name = def.detailed_name;
-        if (def.spell) {
-          parent_kind = def.parent_kind;
-          break;
-        }
-      }
-      break;
-    }
-    case Kind::Var: {
-      idx = db->var_usr[sym.usr];
-      const QueryVar &var = db->vars[idx];
-      for (auto &def : var.def) {
-        kind = def.kind;
-        storage = def.storage;
-        detailed_name = def.detailed_name;
-        if (def.spell) {
-          parent_kind = def.parent_kind;
-          break;
-        }
-      }
-      break;
-    }
-    default:
-      continue; // applies to for loop
     }
 
     if (std::optional<lsRange> loc = getLsRange(wfile, sym.range)) {
@@ -6,6 +6,8 @@
 #include "lsp.hh"
 #include "query.hh"
 
+#include <llvm/ADT/StringSet.h>
+
 #include <functional>
 #include <memory>
 #include <optional>
@@ -19,6 +21,7 @@ struct WorkingFile;
 struct WorkingFiles;
 
 namespace pipeline {
+bool isCancelled(const RequestId &id);
 void reply(const RequestId &id, const std::function<void(JsonWriter &)> &fn);
 void replyError(const RequestId &id, const std::function<void(JsonWriter &)> &fn);
 } // namespace pipeline
@@ -229,6 +232,7 @@ struct ReplyOnce {
     if (id.valid())
       pipeline::replyError(id, [&](JsonWriter &w) { reflect(w, err); });
   }
+  bool cancelled() const { return pipeline::isCancelled(id); }
   void notOpened(std::string_view path);
   void replyLocationLink(std::vector<LocationLink> &result);
 };
@@ -242,6 +246,9 @@ struct MessageHandler {
 
   llvm::StringMap<std::function<void(JsonReader &)>> method2notification;
   llvm::StringMap<std::function<void(JsonReader &, ReplyOnce &)>> method2request;
+  // Requests which do not modify the DB or working files. They may run on
+  // request worker threads under a shared lock.
+  llvm::StringSet<> read_only_requests;
   bool overdue = false;
 
   MessageHandler();
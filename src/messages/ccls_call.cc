@@ -62,42 +62,56 @@ struct Out_outgoingCall {
 };
 REFLECT_STRUCT(Out_outgoingCall, to, fromRanges);
 
-bool expand(MessageHandler *m, Out_cclsCall *entry, bool callee, CallType call_type, bool qualified, int levels) {
-  const QueryFunc &func = m->db->getFunc(entry->usr);
+// Call |fn| with the innermost function enclosing each use of |func|. The
+// functions of a file are collected once for all uses in it.
+template <typename Fn> void eachCaller(DB *db, const QueryFunc &func, Fn &&fn) {
+  std::vector<ExtentRef> funcs1;
+  eachFileSpan(func.uses, [&](int file_id, auto first, auto last) {
+    funcs1.clear();
+    for (auto [sym, refcnt] : db->files[file_id].symbol2refcnt)
+      if (refcnt > 0 && sym.extent.valid() && sym.kind == Kind::Func)
+        funcs1.push_back(sym);
+    for (; first != last; ++first) {
+      Maybe<ExtentRef> best;
+      for (ExtentRef &sym : funcs1)
+        if (sym.extent.start <= first->range.start && first->range.end <= sym.extent.end &&
+            (!best || best->extent.start < sym.extent.start))
+          best = sym;
+      if (best)
+        fn(*best, file_id);
+    }
+  });
+}
+
+bool expand(MessageHandler *m, ReplyOnce &reply, Out_cclsCall *entry, const QueryFunc &func, bool callee,
+            CallType call_type, bool qualified, int levels) {
   const QueryFunc::Def *def = func.anyDef();
   entry->numChildren = 0;
   if (!def)
     return false;
-  auto handle = [&](SymbolRef sym, int file_id, CallType call_type1) {
+  auto handle = [&](const QueryFunc &func1, Range range, Role role, int file_id, CallType call_type1) {
     entry->numChildren++;
-    if (levels > 0) {
+    if (levels > 0 && !reply.cancelled()) {
       Out_cclsCall entry1;
-      entry1.id = std::to_string(sym.usr);
-      entry1.usr = sym.usr;
-      if (auto loc = getLsLocation(m->db, m->wfiles, Use{{sym.range, sym.role}, file_id}))
+      entry1.id = std::to_string(func1.usr);
+      entry1.usr = func1.usr;
+      if (auto loc = getLsLocation(m->db, m->wfiles, Use{{range, role}, file_id}))
         entry1.location = *loc;
       entry1.callType = call_type1;
-      if (expand(m, &entry1, callee, call_type, qualified, levels - 1))
+      if (expand(m, reply, &entry1, func1, callee, call_type, qualified, levels - 1))
         entry->children.push_back(std::move(entry1));
     }
   };
   auto handle_uses = [&](const QueryFunc &func, CallType call_type) {
     if (callee) {
       if (const auto *def = func.anyDef())
-        for (SymbolRef sym : def->callees)
+        for (EntityRef sym : def->callees)
           if (sym.kind == Kind::Func)
-            handle(sym, def->file_id, call_type);
+            handle(m->db->funcs[sym.id], sym.range, sym.role, def->file_id, call_type);
     } else {
-      for (Use use : func.uses) {
-        const QueryFile &file1 = m->db->files[use.file_id];
-        Maybe<ExtentRef> best;
-        for (auto [sym, refcnt] : file1.symbol2refcnt)
-          if (refcnt > 0 && sym.extent.valid() && sym.kind == Kind::Func && sym.extent.start <= use.range.start &&
-              use.range.end <= sym.extent.end && (!best || best->extent.start < sym.extent.start))
-            best = sym;
-        if (best)
-          handle(*best, use.file_id, call_type);
-      }
+      eachCaller(m->db, func, [&](ExtentRef sym, int file_id) {
+        handle(m->db->getFunc(sym.usr), sym.range, sym.role, file_id, call_type);
+      });
     }
   };
 
@@ -146,9 +160,10 @@ bool expand(MessageHandler *m, Out_cclsCall *entry, bool callee, CallType call_t
   return true;
 }
 
-std::optional<Out_cclsCall> buildInitial(MessageHandler *m, Usr root_usr, bool callee, CallType call_type,
-                                         bool qualified, int levels) {
-  const auto *def = m->db->getFunc(root_usr).anyDef();
+std::optional<Out_cclsCall> buildInitial(MessageHandler *m, ReplyOnce &reply, Usr root_usr, bool callee,
+                                         CallType call_type, bool qualified, int levels) {
+  const QueryFunc &func = m->db->getFunc(root_usr);
+  const auto *def = func.anyDef();
   if (!def)
     return {};
 
@@ -160,7 +175,7 @@ std::optional<Out_cclsCall> buildInitial(MessageHandler *m, Usr root_usr, bool c
     if (auto loc = getLsLocation(m->db, m->wfiles, *def->spell))
       entry.location = *loc;
   }
-  expand(m, &entry, callee, call_type, qualified, levels);
+  expand(m, reply, &entry, func, callee, call_type, qualified, levels);
   return entry;
 }
 } // namespace
@@ -180,14 +195,15 @@ void MessageHandler::ccls_call(JsonReader &reader, ReplyOnce &reply) {
     result->usr = param.usr;
     result->callType = CallType::Direct;
     if (db->hasFunc(param.usr))
-      expand(this, &*result, param.callee, param.callType, param.qualified, param.levels);
+      expand(this, reply, &*result, db->getFunc(param.usr), param.callee, param.callType, param.qualified,
+             param.levels);
   } else {
     auto [file, wf] = findOrFail(param.textDocument.uri.getPath(), reply);
     if (!wf)
       return;
     for (SymbolRef sym : findSymbolsAtLocation(wf, file, param.position)) {
       if (sym.kind == Kind::Func) {
-        result = buildInitial(this, sym.usr, param.callee, param.callType, param.qualified, param.levels);
+        result = buildInitial(this, reply, sym.usr, param.callee, param.callType, param.qualified, param.levels);
         break;
       }
     }
@@ -277,16 +293,7 @@ void MessageHandler::callHierarchy_incomingCalls(CallsParam &param, ReplyOnce &r
   }
   const QueryFunc &func = db->getFunc(usr);
   std::map<SymbolIdx, std::pair<int, std::vector<lsRange>>> sym2ranges;
-  for (Use use : func.uses) {
-    const QueryFile &file = db->files[use.file_id];
-    Maybe<ExtentRef> best;
-    for (auto [sym, refcnt] : file.symbol2refcnt)
-      if (refcnt > 0 && sym.extent.valid() && sym.kind == Kind::Func && sym.extent.start <= use.range.start &&
-          use.range.end <= sym.extent.end && (!best || best->extent.start < sym.extent.start))
-        best = sym;
-    if (best)
-      add(sym2ranges, *best, use.file_id);
-  }
+  eachCaller(db, func, [&](ExtentRef sym, int file_id) { add(sym2ranges, sym, file_id); });
   reply(toCallResult<Out_incomingCall>(db, sym2ranges));
 }
 
@@ -300,9 +307,9 @@ void MessageHandler::callHierarchy_outgoingCalls(CallsParam &param, ReplyOnce &r
   const QueryFunc &func = db->getFunc(usr);
   std::map<SymbolIdx, std::pair<int, std::vector<lsRange>>> sym2ranges;
   if (const auto *def = func.anyDef())
-    for (SymbolRef sym : def->callees)
+    for (EntityRef sym : def->callees)
       if (sym.kind == Kind::Func) {
-        add(sym2ranges, sym, def->file_id);
+        add(sym2ranges, {sym.range, db->funcCols().usr[sym.id], sym.kind, sym.role}, def->file_id);
       }
   reply(toCallResult<Out_outgoingCall>(db, sym2ranges));
 }
@@ -61,7 +61,8 @@ bool expandHelper(MessageHandler *m, Out_cclsInheritance *entry, bool derived, b
   std::unordered_set<Usr> seen;
   if (derived) {
     if (levels > 0) {
-      for (auto usr : entity.derived) {
+      for (int id : entity.derived) {
+        Usr usr = (entry->kind == Kind::Func ? m->db->funcCols() : m->db->typeCols()).usr[id];
         if (!seen.insert(usr).second)
           continue;
         Out_cclsInheritance entry1;
@@ -76,7 +77,8 @@ bool expandHelper(MessageHandler *m, Out_cclsInheritance *entry, bool derived, b
       entry->numChildren = int(entity.derived.size());
   } else {
     if (levels > 0) {
-      for (auto usr : def->bases) {
+      for (int id : def->bases) {
+        Usr usr = (entry->kind == Kind::Func ? m->db->funcCols() : m->db->typeCols()).usr[id];
         if (!seen.insert(usr).second)
           continue;
         Out_cclsInheritance entry1;
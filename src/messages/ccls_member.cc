@@ -112,8 +112,8 @@ bool expand(MessageHandler *m, Out_cclsMember *entry, bool qualified, int levels
       if (!def)
         continue;
       if (def->kind != SymbolKind::Namespace)
-        for (Usr usr : def->bases) {
-          auto &type1 = m->db->getType(usr);
+        for (int id : def->bases) {
+          auto &type1 = m->db->types[id];
           if (type1.def.size()) {
             seen.insert(type1.usr);
             stack.push_back(&type1);
@@ -143,11 +143,11 @@ bool expand(MessageHandler *m, Out_cclsMember *entry, bool qualified, int levels
           entry->children.push_back(std::move(entry1));
         }
       } else if (memberKind == Kind::Func) {
-        llvm::DenseSet<Usr, DenseMapInfoForUsr> seen1;
+        llvm::DenseSet<int> seen1;
         for (auto &def : type->def)
-          for (Usr usr : def.funcs)
-            if (seen1.insert(usr).second) {
-              QueryFunc &func1 = m->db->getFunc(usr);
+          for (int id : def.funcs)
+            if (seen1.insert(id).second) {
+              QueryFunc &func1 = m->db->funcs[id];
               if (const QueryFunc::Def *def1 = func1.anyDef()) {
                 Out_cclsMember entry1;
                 entry1.fieldName = def1->name(false);
@@ -162,11 +162,11 @@ bool expand(MessageHandler *m, Out_cclsMember *entry, bool qualified, int levels
               }
             }
       } else if (memberKind == Kind::Type) {
-        llvm::DenseSet<Usr, DenseMapInfoForUsr> seen1;
+        llvm::DenseSet<int> seen1;
         for (auto &def : type->def)
-          for (Usr usr : def.types)
-            if (seen1.insert(usr).second) {
-              QueryType &type1 = m->db->getType(usr);
+          for (int id : def.types)
+            if (seen1.insert(id).second) {
+              QueryType &type1 = m->db->types[id];
               if (const QueryType::Def *def1 = type1.anyDef()) {
                 Out_cclsMember entry1;
                 entry1.fieldName = def1->name(false);
@@ -181,11 +181,11 @@ bool expand(MessageHandler *m, Out_cclsMember *entry, bool qualified, int levels
               }
             }
       } else {
-        llvm::DenseSet<Usr, DenseMapInfoForUsr> seen1;
+        llvm::DenseSet<int> seen1;
         for (auto &def : type->def)
           for (auto it : def.vars)
             if (seen1.insert(it.first).second) {
-              QueryVar &var = m->db->getVar(it.first);
+              QueryVar &var = m->db->vars[it.first];
               if (!var.def.empty())
                 doField(m, entry, var, it.second, qualified, levels - 1);
             }
@@ -214,8 +214,8 @@ std::optional<Out_cclsMember> buildInitial(MessageHandler *m, Kind kind, Usr roo
       if (auto loc = getLsLocation(m->db, m->wfiles, *def->spell))
         entry.location = *loc;
     }
-    for (Usr usr : def->vars) {
-      auto &var = m->db->getVar(usr);
+    for (int id : def->vars) {
+      auto &var = m->db->vars[id];
       if (var.def.size())
         doField(m, &entry, var, -1, qualified, levels - 1);
     }
@@ -315,6 +315,28 @@ void *indexer(void *arg_) {
   pipeline::threadLeave();
   return nullptr;
 }
+
+void *loader(void *arg_) {
+  MessageHandler *h;
+  int idx;
+  auto *arg = static_cast<std::pair<MessageHandler *, int> *>(arg_);
+  std::tie(h, idx) = *arg;
+  delete arg;
+  std::string name = "loader" + std::to_string(idx);
+  set_thread_name(name.c_str());
+  pipeline::loader_Main(h->vfs, h->project, h->wfiles);
+  pipeline::threadLeave();
+  return nullptr;
+}
+
+void replyInitialize(ReplyOnce &reply) {
+  InitializeResult result;
+  auto &c = result.capabilities;
+  c.documentOnTypeFormattingProvider = g_config->capabilities.documentOnTypeFormattingProvider;
+  c.foldingRangeProvider = g_config->capabilities.foldingRangeProvider;
+  c.workspace = g_config->capabilities.workspace;
+  reply(result);
+}
 } // namespace
 
 void do_initialize(MessageHandler *m, InitializeParam &param, ReplyOnce &reply) {
@@ -377,14 +399,7 @@ void do_initialize(MessageHandler *m, InitializeParam &param, ReplyOnce &reply)
 
   // Send initialization before starting indexers, so we don't send a
   // status update too early.
-  {
-    InitializeResult result;
-    auto &c = result.capabilities;
-    c.documentOnTypeFormattingProvider = g_config->capabilities.documentOnTypeFormattingProvider;
-    c.foldingRangeProvider = g_config->capabilities.foldingRangeProvider;
-    c.workspace = g_config->capabilities.workspace;
-    reply(result);
-  }
+  replyInitialize(reply);
 
   // Set project root.
   ensureEndsInSlash(project_path);
@@ -408,9 +423,11 @@ void do_initialize(MessageHandler *m, InitializeParam &param, ReplyOnce &reply)
     else
       LOG_S(INFO) << "workspace folder: " << folder << " -> " << real;
 
+  if (g_config->cache.pack && (g_config->cache.directory.empty() || !pipeline::openPack()))
+    g_config->cache.pack = false;
   if (g_config->cache.directory.empty())
     g_config->cache.retainInMemory = 1;
-  else if (!g_config->cache.hierarchicalPath)
+  else if (!g_config->cache.hierarchicalPath && !g_config->cache.pack)
     for (auto &[folder, _] : workspaceFolders) {
       // Create two cache directories for files inside and outside of the
       // project.
@@ -432,6 +449,14 @@ void do_initialize(MessageHandler *m, InitializeParam &param, ReplyOnce &reply)
   LOG_S(INFO) << "start " << g_config->index.threads << " indexers";
   for (int i = 0; i < g_config->index.threads; i++)
     spawnThread(indexer, new std::pair<MessageHandler *, int>{m, i});
+  if (g_config->cache.directory.empty())
+    g_config->index.loaderThreads = -1;
+  else if (g_config->index.loaderThreads == 0)
+    g_config->index.loaderThreads = g_config->index.threads;
+  if (g_config->index.loaderThreads > 0)
+    LOG_S(INFO) << "start " << g_config->index.loaderThreads << " cache loaders";
+  for (int i = 0; i < g_config->index.loaderThreads; i++)
+    spawnThread(loader, new std::pair<MessageHandler *, int>{m, i});
 
   LOG_S(INFO) << "dispatch initial index requests";
   m->project->index(m->wfiles, reply.id);
@@ -457,6 +482,12 @@ void MessageHandler::initialize(JsonReader &reader, ReplyOnce &reply) {
     reply.error(ErrorCode::InvalidRequest, "expected rootUri");
     return;
   }
+  // In daemon mode, later clients share the project loaded for the first one.
+  if (g_config) {
+    LOG_S(INFO) << "already initialized in " << g_config->fallbackFolder << ", ignore " << param.rootUri->raw_uri;
+    replyInitialize(reply);
+    return;
+  }
   do_initialize(this, param, reply);
 }
 
@@ -1,6 +1,7 @@
 // Copyright 2017-2018 ccls Authors
 // SPDX-License-Identifier: Apache-2.0
 
+#include "fuzzy_match.hh"
 #include "message_handler.hh"
 #include "query.hh"
 
@@ -96,11 +97,12 @@ void MessageHandler::textDocument_definition(TextDocumentPositionParam &param, R
       std::tuple<int, int, bool, int> best_score{INT_MAX, 0, true, 0};
       SymbolIdx best_sym;
       best_sym.kind = Kind::Invalid;
-      auto fn = [&](SymbolIdx sym) {
-        std::string_view short_name = db->getSymbolName(sym, false),
-                         name = short_query.size() < query.size() ? db->getSymbolName(sym, true) : short_name;
-        if (short_name != short_query)
+      auto fn = [&](const DB::Columns &cols, size_t i, Kind kind) {
+        std::string_view short_name = cols.name[i].name(false),
+                         name = short_query.size() < query.size() ? cols.name[i].name(true) : short_name;
+        if (short_name != short_query || cols.spell_file[i] < 0)
           return;
+        SymbolIdx sym{cols.usr[i], kind};
         if (Maybe<DeclRef> dr = getDefinitionSpell(db, sym)) {
           std::tuple<int, int, bool, int> score{int(name.size() - short_query.size()), 0, dr->file_id != file_id,
                                                 std::abs(dr->range.start.line - position.line)};
@@ -117,13 +119,15 @@ void MessageHandler::textDocument_definition(TextDocumentPositionParam &param, R
           }
         }
       };
-      for (auto &func : db->funcs)
-        fn({func.usr, Kind::Func});
-      for (auto &type : db->types)
-        fn({type.usr, Kind::Type});
-      for (auto &var : db->vars)
-        if (var.def.size() && !var.def[0].is_local())
-          fn({var.usr, Kind::Var});
+      uint64_t mask = charMask(short_query);
+      auto scan = [&](const DB::Columns &cols, Kind kind) {
+        for (size_t i = 0; i < cols.usr.size(); i++)
+          if ((cols.name_mask[i] & mask) == mask && !(kind == Kind::Var && cols.local[i]))
+            fn(cols, i, kind);
+      };
+      scan(db->funcCols(), Kind::Func);
+      scan(db->typeCols(), Kind::Type);
+      scan(db->varCols(), Kind::Var);
 
       if (best_sym.kind != Kind::Invalid) {
         Maybe<DeclRef> dr = getDefinitionSpell(db, best_sym);
@@ -20,7 +20,9 @@ void MessageHandler::textDocument_didChange(TextDocumentDidChangeParam &param) {
 
 void MessageHandler::textDocument_didClose(TextDocumentParam &param) {
   std::string path = param.textDocument.uri.getPath();
-  wfiles->onClose(path);
+  // Still open in another client.
+  if (!wfiles->onClose(path))
+    return;
   manager->onClose(path);
   pipeline::removeCache(path);
 }
@@ -54,7 +54,7 @@ void MessageHandler::textDocument_references(JsonReader &reader, ReplyOnce &repl
     std::vector<Usr> stack{sym.usr};
     if (sym.kind != Kind::Func)
       param.base = false;
-    while (stack.size()) {
+    while (stack.size() && !reply.cancelled()) {
       sym.usr = stack.back();
       stack.pop_back();
       auto fn = [&](Use use, SymbolKind parent_kind) {
@@ -69,21 +69,28 @@ void MessageHandler::textDocument_references(JsonReader &reader, ReplyOnce &repl
           if (def.spell) {
             parent_kind = getSymbolKind(db, sym);
             if (param.base)
-              for (Usr usr : make_range(def.bases_begin(), def.bases_end()))
+              for (auto id : make_range(def.bases_begin(), def.bases_end())) {
+                // |base| is only set for functions.
+                Usr usr = db->funcCols().usr[id];
                 if (!seen.count(usr)) {
                   seen.insert(usr);
                   stack.push_back(usr);
                 }
+              }
             break;
           }
-        for (Use use : entity.uses)
-          fn(use, parent_kind);
+        // Skip whole files outside of |folders|.
+        auto fnSpan = [&](int file_id, auto first, auto last) {
+          if (file_set[file_id])
+            for (; first != last; ++first)
+              fn(*first, parent_kind);
+        };
+        eachFileSpan(entity.uses, fnSpan);
         if (param.context.includeDeclaration) {
           for (auto &def : entity.def)
             if (def.spell)
               fn(*def.spell, parent_kind);
-          for (Use use : entity.declarations)
-            fn(use, parent_kind);
+          eachFileSpan(entity.declarations, fnSpan);
         }
       });
     }
@@ -104,7 +111,7 @@ void MessageHandler::textDocument_references(JsonReader &reader, ReplyOnce &repl
       }
     if (path.size())
       for (QueryFile &file1 : db->files)
-        if (file1.def)
+        if (file1.def && !reply.cancelled())
           for (const IndexInclude &include : file1.def->includes)
             if (include.resolved_path == path) {
               // Another file |file1| has the same include line.
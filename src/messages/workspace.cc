@@ -153,24 +153,29 @@ void MessageHandler::workspace_symbol(WorkspaceSymbolParam &param, ReplyOnce &re
   for (char c : query)
     if (!isspace(c))
       query_without_space += c;
+  // Every character of a subsequence match occurs in the name, so an entity
+  // can be skipped without looking at its name unless its mask covers ours.
+  uint64_t mask = charMask(query_without_space);
 
-  auto add = [&](SymbolIdx sym) {
-    std::string_view detailed_name = db->getSymbolName(sym, true);
+  auto add = [&](const DB::Columns &cols, size_t i, Kind kind) {
+    std::string_view detailed_name = cols.name[i].name(true);
     int pos = reverseSubseqMatch(query_without_space, detailed_name, sensitive);
     return pos >= 0 &&
-           addSymbol(db, wfiles, file_set, sym, detailed_name.find(':', pos) != std::string::npos, &cands) &&
+           addSymbol(db, wfiles, file_set, {cols.usr[i], kind}, detailed_name.find(':', pos) != std::string::npos,
+                     &cands) &&
            cands.size() >= g_config->workspaceSymbol.maxNum;
   };
-  for (auto &func : db->funcs)
-    if (add({func.usr, Kind::Func}))
-      goto done_add;
-  for (auto &type : db->types)
-    if (add({type.usr, Kind::Type}))
-      goto done_add;
-  for (auto &var : db->vars)
-    if (var.def.size() && !var.def[0].is_local() && add({var.usr, Kind::Var}))
-      goto done_add;
-done_add:
+  auto scan = [&](const DB::Columns &cols, Kind kind) {
+    for (size_t i = 0; i < cols.usr.size(); i++) {
+      if (i % 4096 == 0 && reply.cancelled())
+        return true;
+      if ((cols.name_mask[i] & mask) == mask && !(kind == Kind::Var && cols.local[i]) && add(cols, i, kind))
+        return true;
+    }
+    return false;
+  };
+  if (!scan(db->funcCols(), Kind::Func) && !scan(db->typeCols(), Kind::Type))
+    scan(db->varCols(), Kind::Var);
 
   if (g_config->workspaceSymbol.sort && query.size() <= FuzzyMatcher::kMaxPat) {
     // Sort results with a fuzzy matching algorithm.
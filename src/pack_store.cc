@@ -0,0 +1,346 @@
+// Copyright 2017-2018 ccls Authors
+// SPDX-License-Identifier: Apache-2.0
+
+#include "pack_store.hh"
+
+#include "log.hh"
+
+#include <llvm/Support/Process.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <string.h>
+
+using namespace llvm;
+
+namespace ccls {
+namespace {
+const char kMagic[8] = {'C', 'C', 'L', 'S', 'P', 'A', 'C', 'K'};
+const char kFooterMagic[8] = {'C', 'C', 'L', 'S', 'I', 'D', 'X', '1'};
+const uint32_t kVersion = 1;
+const uint64_t kHeaderSize = 16;
+
+enum : uint32_t { kPut = 1, kRemove = 2 };
+
+// A record is a RecordHeader followed by the path, the content and the blob.
+struct RecordHeader {
+  uint32_t kind, path_size, content_size, blob_size;
+};
+
+// The footer is a FooterEntry (followed by the path) for each live record and
+// a Trailer at the end of the file.
+struct FooterEntry {
+  uint64_t offset;
+  uint32_t content_size, blob_size, path_size, pad;
+};
+
+struct Trailer {
+  uint64_t index_offset, count;
+  char magic[8];
+};
+
+uint64_t recordSize(size_t path_size, const PackStore::Entry &e) {
+  return sizeof(RecordHeader) + path_size + e.content_size + e.blob_size;
+}
+
+std::string makeHeader() {
+  std::string ret(kMagic, sizeof kMagic);
+  ret.append((const char *)&kVersion, sizeof kVersion);
+  ret.resize(kHeaderSize);
+  return ret;
+}
+} // namespace
+
+bool PackStore::open(const std::string &path) {
+  {
+    std::shared_lock lock(mutex_);
+    if (fd_ >= 0 && path_ == path)
+      return true;
+  }
+  // Switching to another pack. Write the footer of the current one.
+  close();
+  std::lock_guard lock(mutex_);
+  path_ = path;
+  if (!openFiles())
+    return false;
+
+  uint64_t size = 0;
+  std::string header = makeHeader(), old(kHeaderSize, '\0');
+  (void)sys::fs::file_size(path_, size);
+  if (size < kHeaderSize || !readAt(0, old.data(), kHeaderSize) || old != header) {
+    if (size)
+      LOG_S(INFO) << "discard incompatible " << path_;
+    end_ = live_ = 0;
+    if (sys::fs::resize_file(fd_, 0) || !append(header)) {
+      closeFiles();
+      return false;
+    }
+    size = end_;
+  } else if (!loadFooter(size)) {
+    LOG_S(INFO) << "missing index in " << path_ << ", scanning";
+    scan(size);
+  }
+  // Drop the footer or a torn record. New records are appended at end_.
+  if (end_ < size)
+    (void)sys::fs::resize_file(fd_, end_);
+  LOG_S(INFO) << "loaded " << entries_.size() << " entries from " << path_ << " (" << end_ << " bytes, " << live_
+              << " live)";
+  if (end_ > (1 << 20) && end_ - kHeaderSize > 2 * live_)
+    compact();
+  return fd_ >= 0;
+}
+
+void PackStore::close() {
+  std::lock_guard lock(mutex_);
+  if (fd_ < 0)
+    return;
+  std::string footer;
+  for (auto &[path, e] : entries_) {
+    FooterEntry fe{e.offset, e.content_size, e.blob_size, (uint32_t)path.size(), 0};
+    footer.append((const char *)&fe, sizeof fe);
+    footer += path;
+  }
+  Trailer t{end_, entries_.size(), {}};
+  memcpy(t.magic, kFooterMagic, sizeof t.magic);
+  footer.append((const char *)&t, sizeof t);
+  append(footer);
+  closeFiles();
+  entries_.clear();
+}
+
+bool PackStore::load(const std::string &path, std::string &content, std::unique_ptr<MemoryBuffer> &blob) {
+  Entry e;
+  {
+    std::shared_lock lock(mutex_);
+    auto it = entries_.find(path);
+    if (it == entries_.end())
+      return false;
+    e = it->second;
+  }
+  // Records are never overwritten, so the reads need no lock.
+  content.resize(e.content_size);
+  if (!readAt(e.offset, content.data(), e.content_size))
+    return false;
+  auto buf = MemoryBuffer::getOpenFileSlice(read_fd_, path_, e.blob_size, e.offset + e.content_size);
+  if (!buf)
+    return false;
+  blob = std::move(*buf);
+  return true;
+}
+
+std::optional<std::string> PackStore::loadContent(const std::string &path) {
+  Entry e;
+  {
+    std::shared_lock lock(mutex_);
+    auto it = entries_.find(path);
+    if (it == entries_.end())
+      return {};
+    e = it->second;
+  }
+  std::string content(e.content_size, '\0');
+  if (!readAt(e.offset, content.data(), e.content_size))
+    return {};
+  return content;
+}
+
+void PackStore::put(const std::string &path, std::string_view content, std::string_view blob) {
+  RecordHeader h{kPut, (uint32_t)path.size(), (uint32_t)content.size(), (uint32_t)blob.size()};
+  std::string data;
+  data.reserve(sizeof h + path.size() + content.size() + blob.size());
+  data.append((const char *)&h, sizeof h);
+  data += path;
+  data += content;
+  data += blob;
+
+  std::lock_guard lock(mutex_);
+  if (fd_ < 0)
+    return;
+  uint64_t offset = end_ + sizeof h + path.size();
+  if (!append(data))
+    return;
+  auto [it, inserted] = entries_.try_emplace(path);
+  if (!inserted)
+    live_ -= recordSize(path.size(), it->second);
+  it->second = {offset, h.content_size, h.blob_size};
+  live_ += data.size();
+}
+
+void PackStore::remove(const std::string &path) {
+  RecordHeader h{kRemove, (uint32_t)path.size(), 0, 0};
+  std::string data((const char *)&h, sizeof h);
+  data += path;
+
+  std::lock_guard lock(mutex_);
+  auto it = entries_.find(path);
+  if (fd_ < 0 || it == entries_.end() || !append(data))
+    return;
+  live_ -= recordSize(path.size(), it->second);
+  entries_.erase(it);
+}
+
+bool PackStore::openFiles() {
+  if (std::error_code ec =
+          sys::fs::openFileForReadWrite(path_, fd_, sys::fs::CD_OpenAlways, sys::fs::OF_Append)) {
+    LOG_S(ERROR) << "failed to open " << path_ << ": " << ec.message();
+    fd_ = -1;
+    return false;
+  }
+  Expected<sys::fs::file_t> f = sys::fs::openNativeFileForRead(path_);
+  if (!f) {
+    LOG_S(ERROR) << "failed to open " << path_ << ": " << toString(f.takeError());
+    closeFiles();
+    return false;
+  }
+  read_fd_ = *f;
+  return true;
+}
+
+void PackStore::closeFiles() {
+  if (fd_ >= 0)
+    (void)sys::Process::SafelyCloseFileDescriptor(fd_);
+  if (read_fd_ != sys::fs::kInvalidFile)
+    (void)sys::fs::closeFile(read_fd_);
+  fd_ = -1;
+  read_fd_ = sys::fs::kInvalidFile;
+}
+
+bool PackStore::readAt(uint64_t offset, char *buf, size_t size) {
+  while (size) {
+    Expected<size_t> n = sys::fs::readNativeFileSlice(read_fd_, {buf, size}, offset);
+    if (!n) {
+      consumeError(n.takeError());
+      return false;
+    }
+    if (!*n)
+      return false;
+    buf += *n;
+    offset += *n;
+    size -= *n;
+  }
+  return true;
+}
+
+// Append a record at end_. The file is opened with O_APPEND, so concurrent
+// readers are not affected. A partially written record is truncated.
+bool PackStore::append(const std::string &data) {
+  raw_fd_ostream os(fd_, /*shouldClose=*/false);
+  os << data;
+  os.flush();
+  if (os.has_error()) {
+    LOG_S(ERROR) << "failed to write to " << path_ << ": " << os.error().message();
+    os.clear_error();
+    (void)sys::fs::resize_file(fd_, end_);
+    return false;
+  }
+  end_ += data.size();
+  return true;
+}
+
+bool PackStore::loadFooter(uint64_t size) {
+  Trailer t;
+  if (size < kHeaderSize + sizeof t || !readAt(size - sizeof t, (char *)&t, sizeof t) ||
+      memcmp(t.magic, kFooterMagic, sizeof t.magic) || t.index_offset < kHeaderSize ||
+      t.index_offset > size - sizeof t)
+    return false;
+  std::string footer(size - sizeof t - t.index_offset, '\0');
+  if (!readAt(t.index_offset, footer.data(), footer.size()))
+    return false;
+
+  std::unordered_map<std::string, Entry> entries;
+  uint64_t live = 0;
+  const char *p = footer.data(), *end = p + footer.size();
+  for (uint64_t i = 0; i < t.count; i++) {
+    FooterEntry fe;
+    if (size_t(end - p) < sizeof fe)
+      return false;
+    memcpy(&fe, p, sizeof fe);
+    p += sizeof fe;
+    Entry e{fe.offset, fe.content_size, fe.blob_size};
+    if (size_t(end - p) < fe.path_size || e.offset + e.content_size + e.blob_size > t.index_offset)
+      return false;
+    entries.try_emplace(std::string(p, fe.path_size), e);
+    p += fe.path_size;
+    live += recordSize(fe.path_size, e);
+  }
+  if (p != end)
+    return false;
+  entries_ = std::move(entries);
+  end_ = t.index_offset;
+  live_ = live;
+  return true;
+}
+
+void PackStore::scan(uint64_t size) {
+  entries_.clear();
+  live_ = 0;
+  uint64_t offset = kHeaderSize;
+  std::string path;
+  while (offset + sizeof(RecordHeader) <= size) {
+    RecordHeader h;
+    if (!readAt(offset, (char *)&h, sizeof h) || (h.kind != kPut && h.kind != kRemove))
+      break;
+    uint64_t next = offset + sizeof h + h.path_size + uint64_t(h.content_size) + h.blob_size;
+    path.resize(h.path_size);
+    if (next > size || !readAt(offset + sizeof h, path.data(), h.path_size))
+      break;
+    auto it = entries_.find(path);
+    if (it != entries_.end()) {
+      live_ -= recordSize(path.size(), it->second);
+      entries_.erase(it);
+    }
+    if (h.kind == kPut) {
+      entries_.try_emplace(path, Entry{offset + sizeof h + h.path_size, h.content_size, h.blob_size});
+      live_ += next - offset;
+    }
+    offset = next;
+  }
+  end_ = offset;
+}
+
+// Rewrite the live records to a new file and replace the pack with it.
+void PackStore::compact() {
+  std::string tmp = path_ + ".tmp";
+  std::unordered_map<std::string, Entry> entries;
+  uint64_t offset = kHeaderSize;
+  {
+    std::error_code ec;
+    raw_fd_ostream os(tmp, ec, sys::fs::OF_None);
+    if (ec) {
+      LOG_S(ERROR) << "failed to open " << tmp << ": " << ec.message();
+      return;
+    }
+    os << makeHeader();
+    std::string data;
+    for (auto &[path, e] : entries_) {
+      data.resize(e.content_size + e.blob_size);
+      if (!readAt(e.offset, data.data(), data.size()))
+        continue;
+      RecordHeader h{kPut, (uint32_t)path.size(), e.content_size, e.blob_size};
+      os.write((const char *)&h, sizeof h);
+      os << path << data;
+      entries.try_emplace(path, Entry{offset + sizeof h + path.size(), e.content_size, e.blob_size});
+      offset += sizeof h + path.size() + data.size();
+    }
+    os.close();
+    if (os.has_error()) {
+      LOG_S(ERROR) << "failed to write to " << tmp << ": " << os.error().message();
+      os.clear_error();
+      (void)sys::fs::remove(tmp);
+      return;
+    }
+  }
+
+  uint64_t old_end = end_;
+  closeFiles();
+  if (std::error_code ec = sys::fs::rename(tmp, path_)) {
+    LOG_S(ERROR) << "failed to rename " << tmp << ": " << ec.message();
+    (void)sys::fs::remove(tmp);
+    openFiles();
+    return;
+  }
+  entries_ = std::move(entries);
+  end_ = offset;
+  live_ = offset - kHeaderSize;
+  LOG_S(INFO) << "compacted " << path_ << " from " << old_end << " to " << end_ << " bytes";
+  openFiles();
+}
+} // namespace ccls
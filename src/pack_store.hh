@@ -0,0 +1,59 @@
+// Copyright 2017-2018 ccls Authors
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace ccls {
+// An append-only store which keeps the cache (source content and serialized
+// IndexFile) of all indexed paths in one file, avoiding two files per source
+// and the directory tree of hierarchicalPath.
+//
+// The file is a log of put/remove records. On close, an index of the live
+// records is appended as a footer, so that the next open does not need to scan
+// the log. If the footer is missing (e.g. crash), the log is scanned and a
+// torn last record is discarded. Superseded records are garbage; the pack is
+// compacted on open when they take more than half of the file.
+struct PackStore {
+  struct Entry {
+    uint64_t offset; // of the content, followed by the blob
+    uint32_t content_size, blob_size;
+  };
+
+  ~PackStore() { close(); }
+  // Open the pack at |path|. This is a no-op if it is already open.
+  bool open(const std::string &path);
+  void close();
+
+  bool load(const std::string &path, std::string &content, std::unique_ptr<llvm::MemoryBuffer> &blob);
+  std::optional<std::string> loadContent(const std::string &path);
+  void put(const std::string &path, std::string_view content, std::string_view blob);
+  void remove(const std::string &path);
+
+private:
+  bool openFiles();
+  void closeFiles();
+  bool readAt(uint64_t offset, char *buf, size_t size);
+  bool append(const std::string &data);
+  bool loadFooter(uint64_t size);
+  void scan(uint64_t size);
+  void compact();
+
+  std::string path_;
+  int fd_ = -1; // opened for appending
+  llvm::sys::fs::file_t read_fd_ = llvm::sys::fs::kInvalidFile;
+  // end_: end of the log. live_: bytes of records reachable from entries_.
+  uint64_t end_ = 0, live_ = 0;
+  std::shared_mutex mutex_;
+  std::unordered_map<std::string, Entry> entries_;
+};
+} // namespace ccls
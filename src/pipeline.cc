@@ -3,10 +3,12 @@
 
 #include "pipeline.hh"
 
+#include "clang_tu.hh"
 #include "config.hh"
 #include "log.hh"
 #include "lsp.hh"
 #include "message_handler.hh"
+#include "pack_store.hh"
 #include "pipeline.hh"
 #include "platform.hh"
 #include "project.hh"
@@ -16,16 +18,27 @@
 #include <rapidjson/document.h>
 #include <rapidjson/writer.h>
 
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/Path.h>
 #include <llvm/Support/Process.h>
 #include <llvm/Support/Threading.h>
 
+#include <algorithm>
 #include <chrono>
 #include <inttypes.h>
 #include <mutex>
 #include <shared_mutex>
 #include <thread>
+#include <unordered_set>
 #ifndef _WIN32
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 #endif
 using namespace llvm;
@@ -60,6 +73,9 @@ bool VFS::stamp(const std::string &path, int64_t ts, int step) {
   std::lock_guard<std::mutex> lock(mutex);
   State &st = state[path];
   if (st.timestamp < ts || (st.timestamp == ts && st.step < step)) {
+    // The file has changed since it was last seen.
+    if (st.timestamp && st.timestamp < ts)
+      invalidateFileCache(path);
     st.timestamp = ts;
     st.step = step;
     return true;
@@ -67,6 +83,12 @@ bool VFS::stamp(const std::string &path, int64_t ts, int step) {
     return false;
 }
 
+bool VFS::stamped(const std::string &path, int64_t ts, int step) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = state.find(path);
+  return it != state.end() && (it->second.timestamp > ts || (it->second.timestamp == ts && it->second.step >= step));
+}
+
 struct MessageHandler;
 void standaloneInitialize(MessageHandler &, const std::string &root);
 
@@ -87,19 +109,90 @@ struct IndexRequest {
   RequestId id;
   int64_t ts = tick++;
   int prio = 0; // For didOpen sorting
+  bool dependent = false;
+  // Set when a cache loader forwards the request to indexers.
+  int reparse = -1;
+  bool deleted = false;
 };
 
+// Scheduling lanes, highest priority first: files the user is working on,
+// files related to open files, files in the directories of open files, and the
+// rest of the project.
+enum IndexLane { kOpen, kDependent, kRecent, kBackground, kLanes };
+using IndexQueue = LaneQueue<IndexRequest, kLanes>;
+
+int laneOf(const IndexRequest &request) {
+  if (request.mode != IndexMode::Background)
+    return kOpen;
+  if (request.dependent)
+    return kDependent;
+  return request.prio > 0 ? kRecent : kBackground;
+}
+
+// Directory priorities computed on didOpen, applied to new requests as well.
+std::mutex dir2prio_mutex;
+std::unordered_map<std::string, int> g_dir2prio;
+
+int dirPriority(const std::string &path) {
+  std::lock_guard lock(dir2prio_mutex);
+  if (g_dir2prio.empty())
+    return 0;
+  std::string cur = lowerPathIfInsensitive(path);
+  while (!(cur = llvm::sys::path::parent_path(cur)).empty()) {
+    auto it = g_dir2prio.find(cur);
+    if (it != g_dir2prio.end())
+      return it->second;
+  }
+  return 0;
+}
+
 std::mutex thread_mtx;
 std::condition_variable no_active_threads;
 int active_threads;
 
 MultiQueueWaiter *main_waiter;
 MultiQueueWaiter *indexer_waiter;
+MultiQueueWaiter *loader_waiter;
 MultiQueueWaiter *stdout_waiter;
+MultiQueueWaiter *request_waiter;
 ThreadedQueue<InMessage> *on_request;
-ThreadedQueue<IndexRequest> *index_request;
+// Read-only requests, run by request workers under a shared lock of db_mutex.
+// The main thread takes the exclusive lock to apply index updates and to run
+// other messages.
+ThreadedQueue<InMessage> *on_read_request;
+std::shared_mutex db_mutex;
+// The number of read-only requests which have been dispatched but have not
+// locked db_mutex. A message which may modify the state waits for them, so
+// that a request observes the messages received before it and not after.
+std::mutex read_mutex;
+std::condition_variable read_started;
+int unstarted_reads = 0;
+IndexQueue *index_request;
+IndexQueue *load_request;
 ThreadedQueue<IndexUpdate> *on_indexed;
-ThreadedQueue<std::string> *for_stdout;
+// |client| is -1 for stdout, or for all clients in daemon mode.
+struct OutMessage {
+  int client;
+  rapidjson::StringBuffer buffer;
+};
+ThreadedQueue<OutMessage> *for_stdout;
+
+// Bytes queued in for_stdout. Producers wait while it exceeds kMaxStdoutBytes,
+// so that a slow client cannot make the queue grow without bound. In daemon
+// mode, it also bounds the queue of each client.
+const size_t kMaxStdoutBytes = 64 << 20;
+std::mutex stdout_mutex;
+std::condition_variable stdout_drained;
+size_t stdout_bytes = 0;
+
+void pushStdout(int client, rapidjson::StringBuffer &&output) {
+  {
+    std::unique_lock lock(stdout_mutex);
+    stdout_drained.wait(lock, [] { return stdout_bytes < kMaxStdoutBytes || g_quit.load(std::memory_order_relaxed); });
+    stdout_bytes += output.GetSize();
+  }
+  for_stdout->pushBack({client, std::move(output)});
+}
 
 struct InMemoryIndexFile {
   std::string content;
@@ -107,6 +200,7 @@ struct InMemoryIndexFile {
 };
 std::shared_mutex g_index_mutex;
 std::unordered_map<std::string, InMemoryIndexFile> g_index;
+PackStore g_pack;
 
 bool cacheInvalid(VFS *vfs, IndexFile *prev, const std::string &path, const std::vector<const char *> &args,
                   const std::optional<std::string> &from) {
@@ -173,13 +267,32 @@ std::unique_ptr<IndexFile> rawCacheLoad(const std::string &path) {
       return nullptr;
   }
 
-  std::string cache_path = getCachePath(path);
-  std::optional<std::string> file_content = readContent(cache_path);
-  std::optional<std::string> serialized_indexed_content = readContent(appendSerializationFormat(cache_path));
-  if (!file_content || !serialized_indexed_content)
-    return nullptr;
+  std::string file_content;
+  std::unique_ptr<MemoryBuffer> blob;
+  if (g_config->cache.pack) {
+    if (!g_pack.load(path, file_content, blob))
+      return nullptr;
+  } else {
+    std::string cache_path = getCachePath(path);
+    std::optional<std::string> content = readContent(cache_path);
+    if (!content)
+      return nullptr;
+    file_content = std::move(*content);
+    // Large blobs are memory mapped and deserialized in place.
+#if LLVM_VERSION_MAJOR >= 13
+    auto buf = MemoryBuffer::getFile(appendSerializationFormat(cache_path), /*IsText=*/false,
+                                     /*RequiresNullTerminator=*/false);
+#else
+    auto buf = MemoryBuffer::getFile(appendSerializationFormat(cache_path), /*FileSize=*/-1,
+                                     /*RequiresNullTerminator=*/false);
+#endif
+    if (!buf)
+      return nullptr;
+    blob = std::move(*buf);
+  }
 
-  return ccls::deserialize(g_config->cache.format, path, *serialized_indexed_content, *file_content,
+  StringRef serialized = blob->getBuffer();
+  return ccls::deserialize(g_config->cache.format, path, {serialized.data(), serialized.size()}, file_content,
                            IndexFile::kMajorVersion);
 }
 
@@ -189,9 +302,11 @@ std::mutex &getFileMutex(const std::string &path) {
   return mutexes[std::hash<std::string>()(path) % n_MUTEXES];
 }
 
+// If |loader| is true, load the cache and forward the request to indexers if
+// the cache is stale.
 bool indexer_Parse(SemaManager *completion, WorkingFiles *wfiles, Project *project, VFS *vfs,
-                   const GroupMatch &matcher) {
-  std::optional<IndexRequest> opt_request = index_request->tryPopFront();
+                   const GroupMatch &matcher, bool loader) {
+  std::optional<IndexRequest> opt_request = (loader ? load_request : index_request)->tryPopFront();
   if (!opt_request)
     return false;
   auto &request = *opt_request;
@@ -206,13 +321,20 @@ bool indexer_Parse(SemaManager *completion, WorkingFiles *wfiles, Project *proje
   }
 
   struct RAII {
-    ~RAII() { stats.completed++; }
+    bool forwarded = false;
+    ~RAII() {
+      if (!forwarded)
+        stats.completed++;
+    }
   } raii;
   if (!matcher.matches(request.path)) {
     LOG_IF_S(INFO, loud) << "skip " << request.path;
     return false;
   }
 
+  if (isCancelled(request.id))
+    return true;
+
   Project::Entry entry = project->findEntry(request.path, true, request.must_exist);
   if (request.must_exist && entry.filename.empty())
     return true;
@@ -224,7 +346,10 @@ bool indexer_Parse(SemaManager *completion, WorkingFiles *wfiles, Project *proje
   bool deleted = request.mode == IndexMode::Delete,
        no_linkage = g_config->index.initialNoLinkage || request.mode != IndexMode::Background;
   int reparse = 0;
-  if (deleted)
+  if (request.reparse >= 0) {
+    deleted = request.deleted;
+    reparse = request.reparse;
+  } else if (deleted)
     reparse = 2;
   else if (!(g_config->index.onChange && wfiles->getFile(path_to_index))) {
     std::optional<int64_t> write_time = lastWriteTime(path_to_index);
@@ -254,7 +379,7 @@ bool indexer_Parse(SemaManager *completion, WorkingFiles *wfiles, Project *proje
   if (!reparse && !track)
     return true;
 
-  if (reparse < 2)
+  if (reparse < 2 && request.reparse < 0)
     do {
       std::unique_lock lock(getFileMutex(path_to_index));
       prev = rawCacheLoad(path_to_index);
@@ -263,15 +388,12 @@ bool indexer_Parse(SemaManager *completion, WorkingFiles *wfiles, Project *proje
         break;
       if (track)
         for (const auto &dep : prev->dependencies) {
-          if (auto mtime1 = lastWriteTime(dep.first.val().str())) {
-            if (dep.second < *mtime1) {
-              reparse = 2;
-              LOG_V(1) << "timestamp changed for " << path_to_index << " via " << dep.first.val().str();
-              break;
-            }
-          } else {
+          std::string dep_path = dep.first.val().str();
+          std::optional<int64_t> mtime1 = lastWriteTime(dep_path);
+          if (!mtime1 || dep.second < *mtime1) {
+            invalidateFileCache(dep_path);
             reparse = 2;
-            LOG_V(1) << "timestamp changed for " << path_to_index << " via " << dep.first.val().str();
+            LOG_V(1) << "timestamp changed for " << path_to_index << " via " << dep_path;
             break;
           }
         }
@@ -323,6 +445,15 @@ bool indexer_Parse(SemaManager *completion, WorkingFiles *wfiles, Project *proje
       return true;
     } while (0);
 
+  if (loader) {
+    request.reparse = reparse;
+    request.deleted = deleted;
+    raii.forwarded = true;
+    int lane = laneOf(request);
+    index_request->pushBack(std::move(request), lane);
+    return true;
+  }
+
   std::vector<std::unique_ptr<IndexFile>> indexes;
   int n_errs = 0;
   std::string first_error;
@@ -337,8 +468,13 @@ bool indexer_Parse(SemaManager *completion, WorkingFiles *wfiles, Project *proje
       if (content.size())
         remapped.emplace_back(path_to_index, content);
     }
+    // A shared preamble is only used for the initial indexing of the project.
+    // Reindexing a changed file must see the current headers.
+    bool use_preamble = request.mode == IndexMode::Background && !request.dependent && remapped.empty() &&
+                        !vfs->loaded(path_to_index);
     bool ok;
-    auto result = idx::index(wfiles, vfs, entry.directory, path_to_index, entry.args, remapped, no_linkage, ok);
+    auto result =
+        idx::index(wfiles, vfs, entry.directory, path_to_index, entry.args, remapped, no_linkage, use_preamble, ok);
     indexes = std::move(result.indexes);
     n_errs = result.n_errs;
     first_error = std::move(result.first_error);
@@ -390,7 +526,12 @@ bool indexer_Parse(SemaManager *completion, WorkingFiles *wfiles, Project *proje
         auto it = g_index.insert_or_assign(path, InMemoryIndexFile{curr->file_contents, *curr});
         std::string().swap(it.first->second.index.file_contents);
       }
-      if (g_config->cache.directory.size()) {
+      if (g_config->cache.pack) {
+        if (deleted)
+          g_pack.remove(path);
+        else
+          g_pack.put(path, curr->file_contents, serialize(g_config->cache.format, *curr));
+      } else if (g_config->cache.directory.size()) {
         std::string cache_path = getCachePath(path);
         if (deleted) {
           (void)sys::fs::remove(cache_path);
@@ -427,12 +568,21 @@ void quit(SemaManager &manager) {
     std::lock_guard lock(index_request->mutex_);
   }
   indexer_waiter->cv.notify_all();
+  {
+    std::lock_guard lock(load_request->mutex_);
+  }
+  loader_waiter->cv.notify_all();
   {
     std::lock_guard lock(for_stdout->mutex_);
   }
   stdout_waiter->cv.notify_one();
+  {
+    std::lock_guard lock(on_read_request->mutex_);
+  }
+  request_waiter->cv.notify_all();
   std::unique_lock lock(thread_mtx);
   no_active_threads.wait(lock, [] { return !active_threads; });
+  g_pack.close();
 }
 
 } // namespace
@@ -454,35 +604,58 @@ void init() {
   on_indexed = new ThreadedQueue<IndexUpdate>(main_waiter);
 
   indexer_waiter = new MultiQueueWaiter;
-  index_request = new ThreadedQueue<IndexRequest>(indexer_waiter);
+  index_request = new IndexQueue(indexer_waiter);
+
+  loader_waiter = new MultiQueueWaiter;
+  load_request = new IndexQueue(loader_waiter);
 
   stdout_waiter = new MultiQueueWaiter;
-  for_stdout = new ThreadedQueue<std::string>(stdout_waiter);
+  for_stdout = new ThreadedQueue<OutMessage>(stdout_waiter);
+
+  request_waiter = new MultiQueueWaiter;
+  on_read_request = new ThreadedQueue<InMessage>(request_waiter);
 }
 
 void indexer_Main(SemaManager *manager, VFS *vfs, Project *project, WorkingFiles *wfiles) {
   GroupMatch matcher(g_config->index.whitelist, g_config->index.blacklist);
   while (true)
-    if (!indexer_Parse(manager, wfiles, project, vfs, matcher))
+    if (!indexer_Parse(manager, wfiles, project, vfs, matcher, false))
       if (indexer_waiter->wait(g_quit, index_request))
         break;
 }
 
+void loader_Main(VFS *vfs, Project *project, WorkingFiles *wfiles) {
+  GroupMatch matcher(g_config->index.whitelist, g_config->index.blacklist);
+  while (true)
+    if (!indexer_Parse(nullptr, wfiles, project, vfs, matcher, true))
+      if (loader_waiter->wait(g_quit, load_request))
+        break;
+}
+
 void indexerSort(const std::unordered_map<std::string, int> &dir2prio) {
-  index_request->apply([&](std::deque<IndexRequest> &q) {
-    for (IndexRequest &request : q) {
-      std::string cur = lowerPathIfInsensitive(request.path);
-      while (!(cur = llvm::sys::path::parent_path(cur)).empty()) {
-        auto it = dir2prio.find(cur);
-        if (it != dir2prio.end()) {
-          request.prio = it->second;
-          LOG_V(3) << "set priority " << request.prio << " to " << request.path;
-          break;
-        }
+  {
+    std::lock_guard lock(dir2prio_mutex);
+    g_dir2prio = dir2prio;
+  }
+  // Move background requests under the directories to the recent lane. Only
+  // the recent and background lanes are locked, so open files keep indexing.
+  auto sort = [&](IndexQueue::LaneArray &lanes) {
+    std::deque<IndexRequest> &recent = lanes[kRecent], &background = lanes[kBackground];
+    for (IndexRequest &request : recent)
+      request.prio = dirPriority(request.path);
+    std::deque<IndexRequest> rest;
+    for (IndexRequest &request : background)
+      if ((request.prio = dirPriority(request.path)) > 0) {
+        LOG_V(3) << "set priority " << request.prio << " to " << request.path;
+        recent.push_back(std::move(request));
+      } else {
+        rest.push_back(std::move(request));
       }
-    }
-    std::stable_sort(q.begin(), q.end(), [](auto &l, auto &r) { return l.prio > r.prio; });
-  });
+    background = std::move(rest);
+    std::stable_sort(recent.begin(), recent.end(), [](auto &l, auto &r) { return l.prio > r.prio; });
+  };
+  load_request->apply(sort, kRecent);
+  index_request->apply(sort, kRecent);
 }
 
 void main_OnIndexed(DB *db, WorkingFiles *wfiles, IndexUpdate *update) {
@@ -494,7 +667,7 @@ void main_OnIndexed(DB *db, WorkingFiles *wfiles, IndexUpdate *update) {
       if (db->name2file_id.find(path) == db->name2file_id.end())
         continue;
       QueryFile &file = db->files[db->name2file_id[path]];
-      emitSemanticHighlight(db, wf.get(), file);
+      emitSemanticHighlight(db, wf, file);
     }
     if (g_config->client.semanticTokensRefresh) {
       std::optional<bool> param;
@@ -511,7 +684,9 @@ void main_OnIndexed(DB *db, WorkingFiles *wfiles, IndexUpdate *update) {
     if (WorkingFile *wfile = wfiles->getFile(def_u.first.path)) {
       // FIXME With index.onChange: true, use buffer_content only for
       // request.path
-      wfile->setIndexContent(g_config->index.onChange ? wfile->buffer_content : def_u.second);
+      wfiles->eachBuffer(def_u.first.path, [&](WorkingFile *wf) {
+        wf->setIndexContent(g_config->index.onChange ? wf->buffer_content : def_u.second);
+      });
       QueryFile &file = db->files[update->file_id];
       emitSkippedRanges(wfile, file);
       emitSemanticHighlight(db, wfile, file);
@@ -525,100 +700,747 @@ void main_OnIndexed(DB *db, WorkingFiles *wfiles, IndexUpdate *update) {
   }
 }
 
-void launchStdin() {
-  threadEnter();
-  std::thread([]() {
-    set_thread_name("stdin");
-    std::string str;
-    const std::string_view kContentLength("Content-Length: ");
-    bool received_exit = false;
-    while (true) {
-      int len = 0;
-      str.clear();
-      while (true) {
-        int c = getchar();
-        if (c == EOF)
-          goto quit;
-        if (c == '\n') {
-          if (str.empty())
-            break;
-          if (!str.compare(0, kContentLength.size(), kContentLength))
-            len = atoi(str.c_str() + kContentLength.size());
-          str.clear();
-        } else if (c != '\r') {
-          str += c;
+// Pop up to 20 file updates. Queued updates of the same file are merged into
+// one, e.g. when many translation units including the same headers finish at
+// once.
+std::vector<IndexUpdate> popIndexUpdates() {
+  std::vector<IndexUpdate> updates;
+  std::unordered_map<std::string, size_t> path2idx;
+  for (int i = 200; i-- && updates.size() < 20;) {
+    std::optional<IndexUpdate> update = on_indexed->tryPopFront();
+    if (!update)
+      break;
+    if (update->files_def_update) {
+      auto [it, inserted] = path2idx.try_emplace(update->files_def_update->first.path, updates.size());
+      if (!inserted) {
+        updates[it->second].merge(std::move(*update));
+        continue;
+      }
+    }
+    updates.push_back(std::move(*update));
+  }
+  return updates;
+}
+
+template <typename Def> void rewriteDef(Def &def, function_ref<const char *(const char *)> fn) {
+  def.detailed_name = fn(def.detailed_name);
+  def.hover = fn(def.hover);
+  def.comments = fn(def.comments);
+}
+
+// Record the TUs which claim the shared headers (headerClaimers) for the
+// initialOrder of the next start. The dependencies come from the DB, so that
+// the next start does not load every cache on the main thread.
+void saveInitialOrder(DB &db, Project &project) {
+  if (g_config->cache.directory.empty())
+    return;
+  std::vector<std::string> paths;
+  std::vector<ArrayRef<const char *>> deps;
+  {
+    std::lock_guard lock(project.mtx);
+    for (auto &[_, folder] : project.root2folder)
+      for (const Project::Entry &entry : folder.entries) {
+        auto it = db.name2file_id.find(lowerPathIfInsensitive(entry.filename));
+        if (it == db.name2file_id.end())
+          continue;
+        QueryFile &file = db.files[it->second];
+        if (file.def && file.def->dependencies.size()) {
+          paths.push_back(entry.filename);
+          deps.push_back(file.def->dependencies);
         }
       }
+  }
+  std::string content;
+  for (int i : headerClaimers(deps))
+    content += paths[i] + '\n';
+  writeToFile(g_config->cache.directory + kInitialOrderFile, content);
+}
 
-      str.resize(len);
-      for (int i = 0; i < len; ++i) {
-        int c = getchar();
-        if (c == EOF)
-          goto quit;
-        str[i] = c;
+// Free the interned names, hovers and comments which are no longer referenced
+// by the DB or g_index. IndexFile and IndexUpdate in flight are not rewritten,
+// so this is only done when all index requests have completed.
+void reclaimStrings(DB &db) {
+  std::lock_guard lock(g_index_mutex);
+  compactStrings(
+      [] {
+        int64_t completed = stats.completed.load();
+        return completed == stats.enqueued.load() && index_request->isEmpty() && load_request->isEmpty() &&
+               on_indexed->isEmpty();
+      },
+      [&](function_ref<const char *(const char *)> fn) {
+        for (auto &func : db.funcs)
+          for (auto &def : func.def)
+            rewriteDef(def, fn);
+        for (auto &type : db.types)
+          for (auto &def : type.def)
+            rewriteDef(def, fn);
+        for (auto &var : db.vars)
+          for (auto &def : var.def)
+            rewriteDef(def, fn);
+        // The name columns point to the detailed names of the defs.
+        db.updateColumns();
+        for (auto &[_, file] : g_index) {
+          for (auto &[_, func] : file.index.usr2func)
+            rewriteDef(func.def, fn);
+          for (auto &[_, type] : file.index.usr2type)
+            rewriteDef(type.def, fn);
+          for (auto &[_, var] : file.index.usr2var)
+            rewriteDef(var.def, fn);
+        }
+      });
+}
+
+// Reads LSP messages in blocks. Header lines are split in the buffer, and a
+// message body is copied from the buffer or read directly into its
+// destination.
+struct MessageReader {
+  sys::fs::file_t fd;
+  char buf[1 << 16];
+  size_t begin = 0, end = 0;
+
+  explicit MessageReader(sys::fs::file_t fd) : fd(fd) {}
+
+  bool fill() {
+    Expected<size_t> n = sys::fs::readNativeFile(fd, {buf, sizeof buf});
+    if (!n) {
+      consumeError(n.takeError());
+      return false;
+    }
+    begin = 0;
+    end = *n;
+    return end > 0;
+  }
+
+  // Read a line without the trailing \r\n. Return false on EOF.
+  bool readLine(std::string &line) {
+    line.clear();
+    while (true) {
+      auto *nl = static_cast<char *>(memchr(buf + begin, '\n', end - begin));
+      size_t n = (nl ? nl - buf : end) - begin;
+      line.append(buf + begin, n);
+      begin += n;
+      if (nl) {
+        begin++;
+        if (line.size() && line.back() == '\r')
+          line.pop_back();
+        return true;
       }
+      if (!fill())
+        return false;
+    }
+  }
 
-      auto message = std::make_unique<char[]>(len);
-      std::copy(str.begin(), str.end(), message.get());
-      auto document = std::make_unique<rapidjson::Document>();
-      document->Parse(message.get(), len);
-      assert(!document->HasParseError());
+  bool read(char *out, size_t len) {
+    size_t n = std::min(len, end - begin);
+    memcpy(out, buf + begin, n);
+    begin += n;
+    for (out += n, len -= n; len;) {
+      Expected<size_t> r = sys::fs::readNativeFile(fd, {out, len});
+      if (!r) {
+        consumeError(r.takeError());
+        return false;
+      }
+      if (!*r)
+        return false;
+      out += *r;
+      len -= *r;
+    }
+    return true;
+  }
+};
 
-      JsonReader reader{document.get()};
-      if (!reader.m->HasMember("jsonrpc") || std::string((*reader.m)["jsonrpc"].GetString()) != "2.0")
-        break;
-      RequestId id;
-      std::string method;
-      reflectMember(reader, "id", id);
-      reflectMember(reader, "method", method);
-      if (id.valid())
-        LOG_V(2) << "receive RequestMessage: " << id.value << " " << method;
-      else
-        LOG_V(2) << "receive NotificationMessage " << method;
-      if (method.empty())
-        continue;
-      received_exit = method == "exit";
-      // g_config is not available before "initialize". Use 0 in that case.
-      on_request->pushBack(
-          {id, std::move(method), std::move(message), std::move(document),
-           chrono::steady_clock::now() + chrono::milliseconds(g_config ? g_config->request.timeout : 0)});
+// A connection in daemon mode. Clients share the DB, the project, the working
+// files and the indexers. Request ids are prefixed with the client id so that
+// replies can be routed back, and notifications go to all clients.
+//
+// Each client has a reader thread and a writer thread. The stdout thread only
+// appends to |out|, so a client which does not read cannot block the others.
+struct Client {
+  int id;
+  int fd;
+  // URIs of the documents opened by this client. Guarded by clients_mutex.
+  std::unordered_set<std::string> open;
+  // Whether "initialized" has been received. Guarded by clients_mutex.
+  bool initialized = false;
+
+  std::mutex out_mutex;
+  std::condition_variable out_cv;
+  // Messages to be written. Notifications are shared by all clients.
+  std::vector<std::shared_ptr<const rapidjson::StringBuffer>> out;
+  size_t out_bytes = 0;
+  // Set when the connection is closed. Nothing more is written.
+  bool closed = false;
+
+  Client(int id, int fd) : id(id), fd(fd) {}
+  Client(const Client &) = delete;
+#ifndef _WIN32
+  ~Client() { ::close(fd); }
+#endif
+
+  void push(std::shared_ptr<const rapidjson::StringBuffer> message) {
+    std::lock_guard lock(out_mutex);
+    if (closed)
+      return;
+    if (out_bytes + message->GetSize() > kMaxStdoutBytes) {
+      LOG_S(WARNING) << "client " << id << " is not reading its messages, disconnect";
+      closeLocked();
+      return;
+    }
+    out_bytes += message->GetSize();
+    out.push_back(std::move(message));
+    out_cv.notify_one();
+  }
+
+  // Stop the writer thread, and make the reader thread return so that the
+  // client is disconnected.
+  void close() {
+    std::lock_guard lock(out_mutex);
+    closeLocked();
+  }
+
+private:
+  void closeLocked() {
+    if (closed)
+      return;
+    closed = true;
+    out.clear();
+    out_bytes = 0;
+#ifndef _WIN32
+    ::shutdown(fd, SHUT_RDWR);
+#endif
+    out_cv.notify_one();
+  }
+};
+
+bool g_daemon = false;
+std::mutex clients_mutex;
+std::unordered_map<int, std::shared_ptr<Client>> clients;
+// The client with which file watchers are registered, or -1.
+int watch_client = -1;
+// A client which does not make progress writing for so long is disconnected.
+const int kClientWriteTimeout = 30000;
+
+void encodeId(int client, RequestId &id) {
+  if (!id.valid())
+    return;
+  id.value = std::to_string(client) + (id.type == RequestId::kInt ? ":i" : ":s") + id.value;
+  id.type = RequestId::kString;
+}
+
+// Restore the id sent by the client and return the client id, or -1.
+int decodeId(RequestId &id) {
+  if (!g_daemon || id.type != RequestId::kString)
+    return -1;
+  size_t colon = id.value.find(':');
+  if (colon == std::string::npos || colon + 1 >= id.value.size())
+    return -1;
+  int client = atoi(id.value.c_str());
+  id.type = id.value[colon + 1] == 'i' ? RequestId::kInt : RequestId::kString;
+  id.value.erase(0, colon + 2);
+  return client;
+}
 
-      if (received_exit)
+// Requests which have been received but not replied, mapped to whether the
+// client has cancelled them. Keyed by the (encoded) id.
+std::mutex pending_mutex;
+std::unordered_map<std::string, bool> pending;
+std::atomic<int> num_cancelled{0};
+
+std::string pendingKey(const RequestId &id) { return (id.type == RequestId::kInt ? "i" : "s") + id.value; }
+
+void addPending(const RequestId &id) {
+  if (!id.valid())
+    return;
+  std::lock_guard lock(pending_mutex);
+  pending.try_emplace(pendingKey(id), false);
+}
+
+void cancelPending(const RequestId &id) {
+  if (!id.valid())
+    return;
+  std::lock_guard lock(pending_mutex);
+  auto it = pending.find(pendingKey(id));
+  if (it != pending.end() && !it->second) {
+    it->second = true;
+    num_cancelled++;
+  }
+}
+
+// Called when |id| is replied. Return true if it has been cancelled.
+bool removePending(const RequestId &id) {
+  if (!id.valid())
+    return false;
+  std::lock_guard lock(pending_mutex);
+  auto it = pending.find(pendingKey(id));
+  if (it == pending.end())
+    return false;
+  bool cancelled = it->second;
+  if (cancelled)
+    num_cancelled--;
+  pending.erase(it);
+  return cancelled;
+}
+
+// Reply RequestCancelled if |id| has been cancelled.
+bool dropCancelled(const RequestId &id) {
+  if (!isCancelled(id))
+    return false;
+  ResponseError err{ErrorCode::RequestCancelled, "request cancelled"};
+  replyError(id, err);
+  return true;
+}
+
+void pushMessage(const char *json, size_t size, RequestId id, std::string method, int client = -1) {
+  auto message = std::make_unique<char[]>(size + 1);
+  std::copy(json, json + size, message.get());
+  message[size] = '\0';
+  auto document = std::make_unique<rapidjson::Document>();
+  document->ParseInsitu(message.get());
+  InMessage msg{std::move(id), std::move(method), std::move(message), std::move(document),
+                chrono::steady_clock::now()};
+  msg.client = client;
+  on_request->pushBack(std::move(msg));
+}
+
+std::string documentUri(rapidjson::Document &document) {
+  auto params = document.FindMember("params");
+  if (params == document.MemberEnd() || !params->value.IsObject())
+    return {};
+  auto doc = params->value.FindMember("textDocument");
+  if (doc == params->value.MemberEnd() || !doc->value.IsObject())
+    return {};
+  auto uri = doc->value.FindMember("uri");
+  if (uri == doc->value.MemberEnd() || !uri->value.IsString())
+    return {};
+  return uri->value.GetString();
+}
+
+// Reply an error with a null id, for a message whose id cannot be read.
+void replyInvalid(int client, ErrorCode code, const std::string &message) {
+  ResponseError err{code, message};
+  rapidjson::StringBuffer output;
+  rapidjson::Writer<rapidjson::StringBuffer> w(output);
+  JsonWriter writer(&w);
+  w.StartObject();
+  w.Key("jsonrpc");
+  w.String("2.0");
+  w.Key("id");
+  w.Null();
+  w.Key("error");
+  reflect(writer, err);
+  w.EndObject();
+  pushStdout(client, std::move(output));
+}
+
+void pushNotification(const char *method, const std::string &uri, int client = -1) {
+  rapidjson::StringBuffer output;
+  rapidjson::Writer<rapidjson::StringBuffer> w(output);
+  w.StartObject();
+  w.Key("jsonrpc");
+  w.String("2.0");
+  w.Key("method");
+  w.String(method);
+  w.Key("params");
+  w.StartObject();
+  if (uri.size()) {
+    w.Key("textDocument");
+    w.StartObject();
+    w.Key("uri");
+    w.String(uri.c_str(), uri.size());
+    w.EndObject();
+  }
+  w.EndObject();
+  w.EndObject();
+  pushMessage(output.GetString(), output.GetSize(), {}, method, client);
+}
+
+// Called for each message of |client|. Return false to drop the message.
+// Each client has its own buffers of the documents it opens (see WorkingFiles).
+bool filterClientMessage(Client &client, RequestId &id, const std::string &method, rapidjson::Document &document) {
+  encodeId(client.id, id);
+  std::lock_guard lock(clients_mutex);
+  if (method == "initialized") {
+    client.initialized = true;
+    // Registrations are sent to one client. Another client takes over when
+    // it disconnects.
+    if (watch_client >= 0)
+      return false;
+    watch_client = client.id;
+    return true;
+  }
+  if (method == "textDocument/didOpen")
+    client.open.insert(documentUri(document));
+  else if (method == "textDocument/didChange" || method == "textDocument/didSave")
+    return client.open.count(documentUri(document));
+  else if (method == "textDocument/didClose")
+    return client.open.erase(documentUri(document));
+  return true;
+}
+
+// Close the documents opened by |client| and stop writing to it.
+void disconnect(Client &client) {
+  client.close();
+  std::vector<std::string> closed;
+  bool rewatch = false;
+  {
+    std::lock_guard lock(clients_mutex);
+    clients.erase(client.id);
+    closed.assign(client.open.begin(), client.open.end());
+    client.open.clear();
+    // Register file watchers with another client.
+    if (watch_client == client.id) {
+      watch_client = -1;
+      for (auto &[id, other] : clients)
+        if (other->initialized) {
+          watch_client = id;
+          rewatch = true;
+          break;
+        }
+    }
+  }
+  {
+    // Nobody is waiting for the pending requests of |client|.
+    std::lock_guard lock(pending_mutex);
+    std::string prefix = "s" + std::to_string(client.id) + ":";
+    for (auto &[key, cancelled] : pending)
+      if (!cancelled && !key.compare(0, prefix.size(), prefix)) {
+        cancelled = true;
+        num_cancelled++;
+      }
+  }
+  for (const std::string &uri : closed)
+    pushNotification("textDocument/didClose", uri, client.id);
+  if (rewatch)
+    pushNotification("initialized", {});
+  LOG_S(INFO) << "client " << client.id << " disconnected";
+}
+
+// Read messages from |in| and dispatch them to the main thread. |client| is
+// null for stdin. Return true if "exit" has been received.
+bool readMessages(MessageReader &in, Client *client) {
+  std::string line;
+  const std::string_view kContentLength("Content-Length: ");
+  while (true) {
+    int len = 0;
+    while (true) {
+      if (!in.readLine(line))
+        return false;
+      if (line.empty())
         break;
+      if (!line.compare(0, kContentLength.size(), kContentLength))
+        len = atoi(line.c_str() + kContentLength.size());
+    }
+
+    // The document refers to the strings in |message|, which is kept in
+    // InMessage.
+    auto message = std::make_unique<char[]>(len + 1);
+    if (!in.read(message.get(), len))
+      return false;
+    message[len] = '\0';
+    auto document = std::make_unique<rapidjson::Document>();
+    document->ParseInsitu(message.get());
+    // Messages are delimited by Content-Length, so the next one can be read.
+    if (document->HasParseError()) {
+      LOG_S(WARNING) << "failed to parse a message of " << len << " bytes";
+      replyInvalid(client ? client->id : -1, ErrorCode::ParseError, "parse error");
+      continue;
+    }
+    if (!document->IsObject()) {
+      replyInvalid(client ? client->id : -1, ErrorCode::InvalidRequest, "invalid request");
+      continue;
+    }
+
+    JsonReader reader{document.get()};
+    auto jsonrpc = reader.m->FindMember("jsonrpc");
+    if (jsonrpc == reader.m->MemberEnd() || !jsonrpc->value.IsString() ||
+        std::string(jsonrpc->value.GetString()) != "2.0")
+      return false;
+    RequestId id;
+    std::string method;
+    reflectMember(reader, "id", id);
+    reflectMember(reader, "method", method);
+    if (id.valid())
+      LOG_V(2) << "receive RequestMessage: " << id.value << " " << method;
+    else
+      LOG_V(2) << "receive NotificationMessage " << method;
+    if (method.empty())
+      continue;
+    // In daemon mode, "exit" only closes the connection.
+    if (client && (method == "exit" || !filterClientMessage(*client, id, method, *document))) {
+      if (method == "exit")
+        return true;
+      continue;
     }
+    // $/cancelRequest is handled here, so that a request still in on_request
+    // can be dropped.
+    if (method == "$/cancelRequest") {
+      RequestId cancel_id;
+      auto params = document->FindMember("params");
+      if (params != document->MemberEnd() && params->value.IsObject()) {
+        JsonReader reader1{&params->value};
+        reflectMember(reader1, "id", cancel_id);
+      }
+      if (client)
+        encodeId(client->id, cancel_id);
+      cancelPending(cancel_id);
+      continue;
+    }
+    addPending(id);
+    bool received_exit = method == "exit";
+    // g_config is not available before "initialize". Use 0 in that case.
+    InMessage msg{id, std::move(method), std::move(message), std::move(document),
+                  chrono::steady_clock::now() + chrono::milliseconds(g_config ? g_config->request.timeout : 0)};
+    msg.client = client ? client->id : -1;
+    on_request->pushBack(std::move(msg));
+    if (received_exit)
+      return true;
+  }
+}
 
-  quit:
-    if (!received_exit) {
+void launchStdin() {
+  threadEnter();
+  std::thread([]() {
+    set_thread_name("stdin");
+    auto in = std::make_unique<MessageReader>(sys::fs::getStdinHandle());
+    if (!readMessages(*in, nullptr)) {
       const std::string_view str("{\"jsonrpc\":\"2.0\",\"method\":\"exit\"}");
-      auto message = std::make_unique<char[]>(str.size());
-      std::copy(str.begin(), str.end(), message.get());
-      auto document = std::make_unique<rapidjson::Document>();
-      document->Parse(message.get(), str.size());
-      on_request->pushBack(
-          {RequestId(), std::string("exit"), std::move(message), std::move(document), chrono::steady_clock::now()});
+      pushMessage(str.data(), str.size(), RequestId(), "exit");
     }
     threadLeave();
   }).detach();
 }
 
+// Write the messages with their headers in as few writev calls as possible.
+// Return false on an error other than EINTR/EAGAIN. The stream may then end
+// in the middle of a message, so nothing more should be written to |fd|.
+//
+// If |timeout| is not -1, |fd| is a socket. It is written without blocking, and
+// the write fails if no progress is made in |timeout| milliseconds.
+bool writeMessages(int fd, const std::vector<const rapidjson::StringBuffer *> &messages, int timeout = -1) {
+#ifdef _WIN32
+  for (auto *message : messages)
+    llvm::outs() << "Content-Length: " << message->GetSize() << "\r\n\r\n"
+                 << StringRef(message->GetString(), message->GetSize());
+  llvm::outs().flush();
+  return !llvm::outs().has_error();
+#else
+  std::vector<std::string> headers(messages.size());
+  std::vector<iovec> iov;
+  iov.reserve(2 * messages.size());
+  for (size_t i = 0; i < messages.size(); i++) {
+    headers[i] = "Content-Length: " + std::to_string(messages[i]->GetSize()) + "\r\n\r\n";
+    iov.push_back({headers[i].data(), headers[i].size()});
+    iov.push_back({const_cast<char *>(messages[i]->GetString()), messages[i]->GetSize()});
+  }
+  for (size_t i = 0; i < iov.size();) {
+    size_t cnt = std::min<size_t>(iov.size() - i, IOV_MAX);
+    ssize_t n;
+    if (timeout < 0) {
+      n = writev(fd, &iov[i], cnt);
+    } else {
+      msghdr msg{};
+      msg.msg_iov = &iov[i];
+      msg.msg_iovlen = cnt;
+      n = sendmsg(fd, &msg, MSG_DONTWAIT);
+    }
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        pollfd pfd{fd, POLLOUT, 0};
+        int r = poll(&pfd, 1, timeout);
+        if (r > 0 || (r < 0 && errno == EINTR))
+          continue;
+        if (r == 0) {
+          LOG_S(ERROR) << "timed out writing";
+          return false;
+        }
+      }
+      LOG_S(ERROR) << "failed to write: " << strerror(errno);
+      return false;
+    }
+    for (; i < iov.size() && size_t(n) >= iov[i].iov_len; i++)
+      n -= iov[i].iov_len;
+    if (n) {
+      iov[i].iov_base = static_cast<char *>(iov[i].iov_base) + n;
+      iov[i].iov_len -= n;
+    }
+  }
+  return true;
+#endif
+}
+
+// The writer thread of a daemon client. A client which fails or stalls is
+// disconnected.
+void writeClient(Client &client) {
+  std::vector<std::shared_ptr<const rapidjson::StringBuffer>> messages;
+  std::vector<const rapidjson::StringBuffer *> batch;
+  while (true) {
+    {
+      std::unique_lock lock(client.out_mutex);
+      client.out_cv.wait(lock, [&] { return client.out.size() || client.closed; });
+      if (client.closed)
+        return;
+      messages.swap(client.out);
+      client.out_bytes = 0;
+    }
+    batch.clear();
+    for (auto &message : messages)
+      batch.push_back(message.get());
+    if (!writeMessages(client.fd, batch, kClientWriteTimeout)) {
+      client.close();
+      return;
+    }
+    messages.clear();
+  }
+}
+
+bool launchDaemon(const std::string &socket_path) {
+#ifdef _WIN32
+  LOG_S(ERROR) << "daemon mode is not supported on Windows";
+  return false;
+#else
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof addr.sun_path) {
+    LOG_S(ERROR) << "socket path is too long: " << socket_path;
+    return false;
+  }
+  memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    LOG_S(ERROR) << "socket: " << strerror(errno);
+    return false;
+  }
+  (void)unlink(socket_path.c_str());
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) < 0 || listen(fd, 16) < 0) {
+    LOG_S(ERROR) << "failed to listen on " << socket_path << ": " << strerror(errno);
+    ::close(fd);
+    return false;
+  }
+  // A client may go away while a message is being written to it.
+  signal(SIGPIPE, SIG_IGN);
+  g_daemon = true;
+  LOG_S(INFO) << "listening on " << socket_path;
+  std::thread([fd]() {
+    set_thread_name("accept");
+    for (int next_id = 0;;) {
+      int cfd = accept(fd, nullptr, nullptr);
+      if (cfd < 0) {
+        if (errno == EINTR || errno == ECONNABORTED)
+          continue;
+        LOG_S(ERROR) << "accept: " << strerror(errno);
+        break;
+      }
+      auto client = std::make_shared<Client>(next_id++, cfd);
+      {
+        std::lock_guard lock(clients_mutex);
+        clients[client->id] = client;
+      }
+      LOG_S(INFO) << "client " << client->id << " connected";
+      std::thread([client]() {
+        set_thread_name(("client" + std::to_string(client->id)).c_str());
+        auto in = std::make_unique<MessageReader>(client->fd);
+        readMessages(*in, client.get());
+        disconnect(*client);
+      }).detach();
+      std::thread([client]() {
+        set_thread_name(("writer" + std::to_string(client->id)).c_str());
+        writeClient(*client);
+      }).detach();
+    }
+  }).detach();
+  return true;
+#endif
+}
+
 void launchStdout() {
   threadEnter();
   std::thread([]() {
     set_thread_name("stdout");
 
+    std::vector<const rapidjson::StringBuffer *> batch;
+    // Set after a failed write. The messages are then discarded.
+    bool broken = false;
     while (true) {
-      std::vector<std::string> messages = for_stdout->dequeueAll();
-      for (auto &s : messages) {
-        llvm::outs() << "Content-Length: " << s.size() << "\r\n\r\n" << s;
-        llvm::outs().flush();
+      std::vector<OutMessage> messages = for_stdout->dequeueAll();
+      if (messages.size()) {
+        size_t bytes = 0;
+        for (auto &message : messages)
+          bytes += message.buffer.GetSize();
+        if (!g_daemon) {
+          batch.clear();
+          for (auto &message : messages)
+            batch.push_back(&message.buffer);
+          if (!broken && !writeMessages(STDOUT_FILENO, batch))
+            broken = true;
+        } else {
+          // Hand the messages to the writer threads of the clients.
+          std::vector<std::shared_ptr<Client>> targets;
+          {
+            std::lock_guard lock(clients_mutex);
+            for (auto &[_, client] : clients)
+              targets.push_back(client);
+          }
+          for (auto &message : messages) {
+            auto shared = std::make_shared<const rapidjson::StringBuffer>(std::move(message.buffer));
+            for (auto &client : targets)
+              if (message.client < 0 || message.client == client->id)
+                client->push(shared);
+          }
+        }
+        std::lock_guard lock(stdout_mutex);
+        stdout_bytes -= bytes;
+        stdout_drained.notify_all();
       }
       if (stdout_waiter->wait(g_quit, for_stdout))
         break;
     }
+    {
+      std::lock_guard lock(stdout_mutex);
+      stdout_drained.notify_all();
+    }
     threadLeave();
   }).detach();
 }
 
+// Lock db_mutex exclusively after the dispatched read-only requests have
+// started.
+std::unique_lock<std::shared_mutex> lockDB() {
+  {
+    std::unique_lock lock(read_mutex);
+    read_started.wait(lock, [] { return !unstarted_reads || g_quit.load(std::memory_order_relaxed); });
+  }
+  return std::unique_lock(db_mutex);
+}
+
+void request_Main(MessageHandler *handler) {
+  while (true) {
+    std::optional<InMessage> message = on_read_request->tryPopFront();
+    if (!message) {
+      if (request_waiter->wait(g_quit, on_read_request))
+        break;
+      continue;
+    }
+    std::shared_lock lock(db_mutex);
+    {
+      std::lock_guard lock1(read_mutex);
+      if (!--unstarted_reads)
+        read_started.notify_one();
+    }
+    if (g_quit.load(std::memory_order_relaxed))
+      break;
+    try {
+      if (!dropCancelled(message->id))
+        handler->run(*message);
+    } catch (NotIndexed &ex) {
+      // Let the main thread retry when the file is indexed.
+      message->backlog_path = ex.path;
+      on_request->pushBack(std::move(*message));
+    }
+  }
+}
+
 void mainLoop() {
   Project project;
   WorkingFiles wfiles;
@@ -653,12 +1475,34 @@ void mainLoop() {
 
   bool work_done_created = false, in_progress = false;
   bool has_indexed = false;
+  // Whether saveInitialOrder has run after the initial index.
+  bool order_saved = false;
   int64_t last_completed = 0;
+  int request_threads = 0;
   std::deque<InMessage> backlog;
   StringMap<std::deque<InMessage *>> path2backlog;
+  auto addBacklog = [&](InMessage &&message) {
+    backlog.push_back(std::move(message));
+    path2backlog[backlog.back().backlog_path].push_back(&backlog.back());
+  };
   while (true) {
-    if (backlog.size()) {
-      auto now = chrono::steady_clock::now();
+    // Drop cancelled requests waiting for their files to be indexed.
+    if (backlog.size() && num_cancelled.load(std::memory_order_relaxed))
+      for (InMessage &message : backlog)
+        if (message.backlog_path.size() && dropCancelled(message.id)) {
+          auto it = path2backlog.find(message.backlog_path);
+          it->second.erase(std::find(it->second.begin(), it->second.end(), &message));
+          if (it->second.empty())
+            path2backlog.erase(it);
+          message.backlog_path.clear();
+        }
+    // Entries with an empty backlog_path have been run or dropped.
+    while (backlog.size() && backlog[0].backlog_path.empty())
+      backlog.pop_front();
+    // Only take the DB lock if the oldest request is overdue.
+    auto now = chrono::steady_clock::now();
+    if (backlog.size() && backlog[0].deadline <= now) {
+      auto lock = lockDB();
       handler.overdue = true;
       while (backlog.size()) {
         if (backlog[0].backlog_path.size()) {
@@ -674,36 +1518,66 @@ void mainLoop() {
 
     std::vector<InMessage> messages = on_request->dequeueAll();
     bool did_work = messages.size();
-    for (InMessage &message : messages)
+    for (InMessage &message : messages) {
+      if (dropCancelled(message.id))
+        continue;
+      // Sent back by a request worker as the file was not indexed.
+      if (message.backlog_path.size()) {
+        if (!handler.findFile(message.backlog_path)) {
+          addBacklog(std::move(message));
+          continue;
+        }
+        message.backlog_path.clear();
+      }
+      if (g_config && g_config->request.threads > 0 && handler.read_only_requests.count(message.method)) {
+        for (; request_threads < g_config->request.threads; request_threads++) {
+          threadEnter();
+          std::thread([&handler]() {
+            set_thread_name("request");
+            request_Main(&handler);
+            threadLeave();
+          }).detach();
+        }
+        {
+          std::lock_guard lock(read_mutex);
+          unstarted_reads++;
+        }
+        on_read_request->pushBack(std::move(message));
+        continue;
+      }
+      auto lock = lockDB();
       try {
         handler.run(message);
       } catch (NotIndexed &ex) {
-        backlog.push_back(std::move(message));
-        backlog.back().backlog_path = ex.path;
-        path2backlog[ex.path].push_back(&backlog.back());
+        message.backlog_path = ex.path;
+        addBacklog(std::move(message));
       }
+    }
 
     // If the "exit" notification has been received, clear all index requests
     // to make indexers stop in time.
     if (g_quit.load(std::memory_order_relaxed)) {
-      index_request->apply([&](std::deque<IndexRequest> &q) {
-        q.clear();
-      });
+      auto clear = [](IndexQueue::LaneArray &lanes) {
+        for (auto &q : lanes)
+          q.clear();
+      };
+      index_request->apply(clear);
+      load_request->apply(clear);
     }
 
     bool indexed = false;
-    for (int i = 20; i--;) {
-      std::optional<IndexUpdate> update = on_indexed->tryPopFront();
-      if (!update)
-        break;
+    for (IndexUpdate &update : popIndexUpdates()) {
       did_work = true;
       indexed = true;
-      main_OnIndexed(&db, &wfiles, &*update);
-      if (update->files_def_update) {
-        auto it = path2backlog.find(update->files_def_update->first.path);
+      // Lock for each update, so that read-only requests can run in between.
+      std::unique_lock lock(db_mutex);
+      main_OnIndexed(&db, &wfiles, &update);
+      if (update.files_def_update) {
+        auto it = path2backlog.find(update.files_def_update->first.path);
         if (it != path2backlog.end()) {
           for (auto &message : it->second) {
-            handler.run(*message);
+            if (!dropCancelled(message->id))
+              handler.run(*message);
             message->backlog_path.clear();
           }
           path2backlog.erase(it);
@@ -753,6 +1627,17 @@ void mainLoop() {
         break;
     } else {
       if (has_indexed) {
+        {
+          std::unique_lock lock(db_mutex);
+          reclaimStrings(db);
+        }
+        if (stats.completed == stats.enqueued) {
+          clearFileCache();
+          if (!order_saved) {
+            saveInitialOrder(db, project);
+            order_saved = true;
+          }
+        }
         freeUnusedMemory();
         has_indexed = false;
       }
@@ -779,6 +1664,7 @@ void standalone(const std::string &root) {
   handler.vfs = &vfs;
   handler.manager = &manager;
 
+  auto start = std::chrono::steady_clock::now();
   standaloneInitialize(handler, root);
   bool tty = sys::Process::StandardOutIsDisplayed();
 
@@ -801,14 +1687,30 @@ void standalone(const std::string &root) {
   }
   if (tty)
     puts("");
+  sys::TimePoint<> now;
+  std::chrono::nanoseconds user, system;
+  sys::Process::GetTimeUsage(now, user, system);
+  LOG_S(INFO) << "indexed " << stats.completed << " files in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+              << "ms, CPU " << std::chrono::duration_cast<std::chrono::milliseconds>(user + system).count() << "ms";
   quit(manager);
 }
 
 void index(const std::string &path, const std::vector<const char *> &args, IndexMode mode, bool must_exist,
-           RequestId id) {
-  if (!path.empty())
+           RequestId id, bool dependent) {
+  if (!path.empty()) {
     stats.enqueued++;
-  index_request->pushBack({path, args, mode, must_exist, std::move(id)}, mode != IndexMode::Background);
+    invalidateFileCache(path);
+  }
+  // Initial loads go through cache loaders, which forward stale files to
+  // indexers.
+  auto *queue = g_config->index.loaderThreads > 0 && mode == IndexMode::Background ? load_request : index_request;
+  IndexRequest request{path, args, mode, must_exist, std::move(id)};
+  request.dependent = dependent;
+  if (mode == IndexMode::Background && !dependent)
+    request.prio = dirPriority(path);
+  int lane = laneOf(request);
+  queue->pushBack(std::move(request), lane);
 }
 
 void removeCache(const std::string &path) {
@@ -826,9 +1728,16 @@ std::optional<std::string> loadIndexedContent(const std::string &path) {
       return {};
     return it->second.content;
   }
+  if (g_config->cache.pack)
+    return g_pack.loadContent(path);
   return readContent(getCachePath(path));
 }
 
+bool openPack() {
+  sys::fs::create_directories(g_config->cache.directory);
+  return g_pack.open(g_config->cache.directory + "ccls.pack");
+}
+
 void notifyOrRequest(const char *method, bool request, const std::function<void(JsonWriter &)> &fn) {
   rapidjson::StringBuffer output;
   rapidjson::Writer<rapidjson::StringBuffer> w(output);
@@ -846,10 +1755,26 @@ void notifyOrRequest(const char *method, bool request, const std::function<void(
   fn(writer);
   w.EndObject();
   LOG_V(2) << (request ? "RequestMessage: " : "NotificationMessage: ") << method;
-  for_stdout->pushBack(output.GetString());
+  int client = -1;
+  // In daemon mode, file watchers are registered with one client.
+  if (g_daemon && !strcmp(method, "client/registerCapability")) {
+    std::lock_guard lock(clients_mutex);
+    client = watch_client;
+  }
+  pushStdout(client, std::move(output));
+}
+
+bool isCancelled(const RequestId &id) {
+  if (!num_cancelled.load(std::memory_order_relaxed) || !id.valid())
+    return false;
+  std::lock_guard lock(pending_mutex);
+  auto it = pending.find(pendingKey(id));
+  return it != pending.end() && it->second;
 }
 
-static void reply(const RequestId &id, const char *key, const std::function<void(JsonWriter &)> &fn) {
+static void reply(RequestId id, const char *key, const std::function<void(JsonWriter &)> &fn) {
+  bool cancelled = removePending(id);
+  int client = decodeId(id);
   rapidjson::StringBuffer output;
   rapidjson::Writer<rapidjson::StringBuffer> w(output);
   w.StartObject();
@@ -867,13 +1792,20 @@ static void reply(const RequestId &id, const char *key, const std::function<void
     w.String(id.value.c_str(), id.value.size());
     break;
   }
-  w.Key(key);
   JsonWriter writer(&w);
-  fn(writer);
+  if (cancelled) {
+    // A handler may stop early and reply a partial result.
+    ResponseError err{ErrorCode::RequestCancelled, "request cancelled"};
+    w.Key("error");
+    reflect(writer, err);
+  } else {
+    w.Key(key);
+    fn(writer);
+  }
   w.EndObject();
   if (id.valid())
     LOG_V(2) << "respond to RequestMessage: " << id.value;
-  for_stdout->pushBack(output.GetString());
+  pushStdout(client, std::move(output));
 }
 
 void reply(const RequestId &id, const std::function<void(JsonWriter &)> &fn) { reply(id, "result", fn); }
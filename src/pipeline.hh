@@ -30,6 +30,8 @@ struct VFS {
   void clear();
   int loaded(const std::string &path);
   bool stamp(const std::string &path, int64_t ts, int step);
+  // Whether stamp(path, ts, step) would return false.
+  bool stamped(const std::string &path, int64_t ts, int step);
 };
 
 enum class IndexMode {
@@ -54,15 +56,21 @@ void threadLeave();
 void init();
 void launchStdin();
 void launchStdout();
+// Serve LSP clients connecting to |socket_path| instead of stdin.
+bool launchDaemon(const std::string &socket_path);
 void indexer_Main(SemaManager *manager, VFS *vfs, Project *project, WorkingFiles *wfiles);
+void loader_Main(VFS *vfs, Project *project, WorkingFiles *wfiles);
 void indexerSort(const std::unordered_map<std::string, int> &dir2prio);
 void mainLoop();
 void standalone(const std::string &root);
 
+// |dependent|: a file related to an open file, scheduled before the rest of the
+// background requests.
 void index(const std::string &path, const std::vector<const char *> &args, IndexMode mode, bool must_exist,
-           RequestId id = {});
+           RequestId id = {}, bool dependent = false);
 void removeCache(const std::string &path);
 std::optional<std::string> loadIndexedContent(const std::string &path);
+bool openPack();
 
 void notifyOrRequest(const char *method, bool request, const std::function<void(JsonWriter &)> &fn);
 template <typename T> void notify(const char *method, T &result) {
@@ -72,6 +80,11 @@ template <typename T> void request(const char *method, T &result) {
   notifyOrRequest(method, true, [&](JsonWriter &w) { reflect(w, result); });
 }
 
+// Whether the client has sent $/cancelRequest for |id|. Long-running handlers
+// may check it and return early; the reply is then replaced with a
+// RequestCancelled error.
+bool isCancelled(const RequestId &id);
+
 void reply(const RequestId &id, const std::function<void(JsonWriter &)> &fn);
 
 void replyError(const RequestId &id, const std::function<void(JsonWriter &)> &fn);
@@ -16,6 +16,7 @@
 #include <clang/Driver/Types.h>
 #include <clang/Frontend/CompilerInstance.h>
 #include <clang/Tooling/CompilationDatabase.h>
+#include <llvm/ADT/DenseSet.h>
 #include <llvm/ADT/STLExtras.h>
 #include <llvm/ADT/StringSet.h>
 #include <llvm/Support/GlobPattern.h>
@@ -31,7 +32,9 @@
 #endif
 
 #include <array>
+#include <queue>
 #include <limits.h>
+#include <map>
 #include <unordered_set>
 #include <vector>
 
@@ -256,8 +259,77 @@ int computeGuessScore(std::string_view a, std::string_view b) {
   return score;
 }
 
+// Order the entries for the initial index. Only the first TU that reaches a
+// header indexes it (VFS::stamp). |first| are the TUs which claimed the shared
+// headers in the previous index (see headerClaimers), and are scheduled first
+// in their order. TUs in the same directory tend to include the same headers:
+// interleave directories for the others, so that concurrent indexers do not
+// parse the same unclaimed headers. This runs on the main thread, which should
+// not stat every TU or load their caches.
+std::vector<const Project::Entry *> initialOrder(const std::vector<Project::Entry> &entries,
+                                                 const StringMap<int> &first) {
+  std::vector<std::pair<int, const Project::Entry *>> claimers;
+  std::map<StringRef, std::vector<const Project::Entry *>> dir2entries;
+  size_t rounds = 0;
+  for (const Project::Entry &entry : entries) {
+    auto it = first.find(entry.filename);
+    if (it != first.end()) {
+      claimers.emplace_back(it->second, &entry);
+      continue;
+    }
+    auto &v = dir2entries[sys::path::parent_path(entry.filename)];
+    v.push_back(&entry);
+    rounds = std::max(rounds, v.size());
+  }
+  llvm::sort(claimers, [](auto &l, auto &r) { return l.first < r.first; });
+  std::vector<const Project::Entry *> ret;
+  ret.reserve(entries.size());
+  for (auto &claimer : claimers)
+    ret.push_back(claimer.second);
+  for (size_t i = 0; i < rounds; i++)
+    for (auto &[_, v] : dir2entries)
+      if (i < v.size())
+        ret.push_back(v[i]);
+  return ret;
+}
 } // namespace
 
+std::vector<int> headerClaimers(const std::vector<ArrayRef<const char *>> &deps) {
+  DenseMap<const char *, int> count;
+  for (ArrayRef<const char *> tu : deps)
+    for (const char *path : tu)
+      count[path]++;
+  // Greedy set cover with lazy gains: a popped gain is an upper bound, so a TU
+  // whose recomputed gain is still the largest is picked.
+  DenseSet<const char *> claimed;
+  auto gain = [&](int i) {
+    int n = 0;
+    for (const char *path : deps[i])
+      n += count[path] > 1 && !claimed.count(path);
+    return n;
+  };
+  std::priority_queue<std::pair<int, int>> heap;
+  for (int i = 0; i < int(deps.size()); i++)
+    if (int n = gain(i))
+      heap.emplace(n, -i);
+  std::vector<int> ret;
+  while (heap.size()) {
+    auto [n, i] = heap.top();
+    heap.pop();
+    int n1 = gain(-i);
+    if (n1 < n) {
+      if (n1)
+        heap.emplace(n1, i);
+      continue;
+    }
+    ret.push_back(-i);
+    for (const char *path : deps[-i])
+      if (count[path] > 1)
+        claimed.insert(path);
+  }
+  return ret;
+}
+
 void Project::loadDirectory(const std::string &root, Project::Folder &folder) {
   SmallString<256> cdbDir, path, stdinPath;
   std::string err_msg;
@@ -507,11 +579,21 @@ void Project::index(WorkingFiles *wfiles, const RequestId &id) {
     prepend_args.push_back(intern(arg));
   for (StringRef arg : g_config->clang.extraArgs)
     extra_args.push_back(intern(arg));
+  // Written by the previous index, see pipeline::saveInitialOrder.
+  StringMap<int> first;
+  if (g_config->cache.directory.size())
+    if (std::optional<std::string> content = readContent(g_config->cache.directory + kInitialOrderFile)) {
+      SmallVector<StringRef, 0> lines;
+      StringRef(*content).split(lines, '\n', -1, false);
+      for (StringRef line : lines)
+        first.try_emplace(line, first.size());
+    }
   {
     std::lock_guard lock(mtx);
     for (auto &[root, folder] : root2folder) {
       int i = 0;
-      for (const Project::Entry &entry : folder.entries) {
+      for (const Project::Entry *e : initialOrder(folder.entries, first)) {
+        const Project::Entry &entry = *e;
         std::string reason;
         if (match.matches(entry.filename, &reason) && match_i.matches(entry.filename, &reason)) {
           bool interactive = wfiles->getFile(entry.filename) != nullptr;
@@ -553,7 +635,7 @@ void Project::indexRelated(const std::string &path) {
         args.push_back(intern("-working-directory=" + entry.directory));
         args.insert(args.begin() + 1, prepend_args.begin(), prepend_args.end());
         if (sys::path::stem(entry.filename) == stem && entry.filename != path && match.matches(entry.filename, &reason))
-          pipeline::index(entry.filename, args, IndexMode::Background, true);
+          pipeline::index(entry.filename, args, IndexMode::Background, true, {}, true);
       }
       break;
     }
@@ -6,6 +6,8 @@
 #include "config.hh"
 #include "lsp.hh"
 
+#include <llvm/ADT/ArrayRef.h>
+
 #include <functional>
 #include <mutex>
 #include <string>
@@ -17,6 +19,15 @@ struct WorkingFiles;
 
 std::pair<LanguageId, bool> lookupExtension(std::string_view filename);
 
+// The TUs to index first, recorded in the cache directory by the previous
+// index, one path per line.
+constexpr const char kInitialOrderFile[] = "ccls.order";
+
+// Given the dependencies of each TU (interned paths), return the indices of
+// TUs such that each file depended on by two or more TUs is a dependency of one
+// of them. TUs covering more of the shared files come first.
+std::vector<int> headerClaimers(const std::vector<llvm::ArrayRef<const char *>> &deps);
+
 struct Project {
   struct Entry {
     std::string root;
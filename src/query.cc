@@ -3,25 +3,97 @@
 
 #include "query.hh"
 
+#include "config.hh"
+#include "fuzzy_match.hh"
 #include "indexer.hh"
 #include "pipeline.hh"
 #include "serializer.hh"
 
 #include <rapidjson/document.h>
 
+#include <llvm/ADT/DenseSet.h>
 #include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/Twine.h>
+#include <llvm/Support/Threading.h>
 
 #include <assert.h>
+#include <condition_variable>
 #include <functional>
 #include <limits.h>
+#include <mutex>
 #include <optional>
 #include <stdint.h>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 
 namespace ccls {
 namespace {
+// Number of Usr entries in the uses sections of an IndexUpdate above which the
+// sections are applied in parallel.
+constexpr size_t kParallelApplyThreshold = 1024;
+
+// Threads which apply the sections and refcnt shards of large updates. They
+// are created on first use and then wait for the next update, instead of being
+// created and joined for each one.
+class ApplyPool {
+public:
+  // Call fn(0) on the calling thread and fn(1), ..., fn(n-1) on the workers,
+  // and return when all have returned.
+  void run(int n, llvm::function_ref<void(int)> fn);
+
+private:
+  void worker(int i);
+
+  std::mutex run_mutex_, mutex_;
+  std::condition_variable start_, done_;
+  llvm::function_ref<void(int)> fn_;
+  uint64_t generation_ = 0;
+  int n_ = 0, pending_ = 0, threads_ = 0;
+};
+
+void ApplyPool::run(int n, llvm::function_ref<void(int)> fn) {
+  std::lock_guard run_lock(run_mutex_);
+  {
+    std::lock_guard lock(mutex_);
+    for (; threads_ < n - 1; threads_++)
+      std::thread([this, i = threads_ + 1] { worker(i); }).detach();
+    fn_ = fn;
+    n_ = n;
+    pending_ = n - 1;
+    generation_++;
+  }
+  start_.notify_all();
+  fn(0);
+  std::unique_lock lock(mutex_);
+  done_.wait(lock, [&] { return !pending_; });
+}
+
+void ApplyPool::worker(int i) {
+  llvm::set_thread_name("apply");
+  uint64_t seen = 0;
+  std::unique_lock lock(mutex_);
+  while (true) {
+    start_.wait(lock, [&] { return generation_ != seen; });
+    seen = generation_;
+    if (i >= n_)
+      continue;
+    auto fn = fn_;
+    lock.unlock();
+    fn(i);
+    lock.lock();
+    if (!--pending_)
+      done_.notify_one();
+  }
+}
+
+// Never destroyed, as the workers are detached.
+ApplyPool &applyPool() {
+  static ApplyPool *pool = new ApplyPool;
+  return *pool;
+}
+
 void assignFileId(const Lid2file_id &lid2file_id, int file_id, Use &use) {
   if (use.file_id == -1)
     use.file_id = file_id;
@@ -29,18 +101,93 @@ void assignFileId(const Lid2file_id &lid2file_id, int file_id, Use &use) {
     use.file_id = lid2file_id.find(use.file_id)->second;
 }
 
-template <typename T> void addRange(std::vector<T> &into, const std::vector<T> &from) {
-  into.insert(into.end(), from.begin(), from.end());
+void spliceRange(std::vector<int> &into, std::vector<int> &to_remove, std::vector<int> &to_add) {
+  if (to_remove.size()) {
+    llvm::sort(to_remove);
+    into.erase(std::remove_if(into.begin(), into.end(),
+                              [&](int id) { return std::binary_search(to_remove.begin(), to_remove.end(), id); }),
+               into.end());
+  }
+  into.insert(into.end(), to_add.begin(), to_add.end());
 }
 
-template <typename T> void removeRange(std::vector<T> &from, const std::vector<T> &to_remove) {
-  if (to_remove.size()) {
-    std::unordered_set<T> to_remove_set(to_remove.begin(), to_remove.end());
-    from.erase(std::remove_if(from.begin(), from.end(), [&](const T &t) { return to_remove_set.count(t) > 0; }),
-               from.end());
+// Uses and declarations of an entity are kept sorted by this total order:
+// file_id, then range, role and extent. Replacing the contribution of a file is
+// a splice of its span instead of a scan of the whole vector, and elements
+// differing only in role or extent are told apart.
+template <typename T> bool refLess(const T &l, const T &r) {
+  if (l.file_id != r.file_id)
+    return l.file_id < r.file_id;
+  if (!(l.range == r.range))
+    return l.range < r.range;
+  if (l.role != r.role)
+    return l.role < r.role;
+  if constexpr (std::is_same_v<T, DeclRef>)
+    return l.extent < r.extent;
+  return false;
+}
+
+// Sort |to_remove| and |to_add| in place and call |fn| with the file_id and the
+// [first, last) ranges of |to_remove| and |to_add| in each file.
+template <typename T, typename Fn> void eachFileDelta(std::vector<T> &to_remove, std::vector<T> &to_add, Fn &&fn) {
+  llvm::sort(to_remove, refLess<T>);
+  llvm::sort(to_add, refLess<T>);
+  auto rem = to_remove.begin(), add = to_add.begin();
+  while (rem != to_remove.end() || add != to_add.end()) {
+    int file_id = rem == to_remove.end()  ? add->file_id
+                  : add == to_add.end() ? rem->file_id
+                                        : std::min(rem->file_id, add->file_id);
+    auto other_file = [&](const T &x) { return x.file_id != file_id; };
+    auto rem_end = std::find_if(rem, to_remove.end(), other_file);
+    auto add_end = std::find_if(add, to_add.end(), other_file);
+    fn(file_id, rem, rem_end, add, add_end);
+    rem = rem_end;
+    add = add_end;
   }
 }
 
+// Set |span| to the sorted [first, last) without [rem, rem_end) and with
+// [add, add_end).
+template <typename It, typename DIt, typename T>
+void spliceSpan(It first, It last, DIt rem, DIt rem_end, DIt add, DIt add_end, std::vector<T> &span) {
+  span.clear();
+  std::set_difference(first, last, rem, rem_end, std::back_inserter(span), refLess<T>);
+  size_t kept = span.size();
+  span.insert(span.end(), add, add_end);
+  std::inplace_merge(span.begin(), span.begin() + kept, span.end(), refLess<T>);
+}
+
+template <typename Vec, typename T>
+void spliceRange(Vec &into, std::vector<T> &to_remove, std::vector<T> &to_add) {
+  std::vector<T> span;
+  eachFileDelta(to_remove, to_add, [&](int file_id, auto rem, auto rem_end, auto add, auto add_end) {
+    size_t lo = std::lower_bound(into.begin(), into.end(), file_id,
+                                 [](const T &x, int id) { return x.file_id < id; }) -
+                into.begin();
+    size_t hi = std::upper_bound(into.begin() + lo, into.end(), file_id,
+                                 [](int id, const T &x) { return id < x.file_id; }) -
+                into.begin();
+    spliceSpan(into.begin() + lo, into.begin() + hi, rem, rem_end, add, add_end, span);
+
+    size_t n = std::min(span.size(), hi - lo);
+    std::copy(span.begin(), span.begin() + n, into.begin() + lo);
+    if (span.size() < hi - lo)
+      into.erase(into.begin() + lo + n, into.begin() + hi);
+    else
+      into.insert(into.begin() + hi, span.begin() + n, span.end());
+  });
+}
+
+// The intermediate state cancels out: keep the removals of |into| and the
+// additions of |from|.
+template <typename T> void mergeUpdate(Update<T> &into, Update<T> &from) {
+  for (auto &[usr, p] : into)
+    if (!from.count(usr))
+      p.second.clear();
+  for (auto &[usr, p] : from)
+    into[usr].second = std::move(p.second);
+}
+
 QueryFile::DefUpdate buildFileDefUpdate(IndexFile &&indexed) {
   QueryFile::Def def;
   def.path = std::move(indexed.path);
@@ -66,14 +213,205 @@ template <typename Q> bool tryReplaceDef(llvm::SmallVectorImpl<Q> &def_list, Q &
 
 } // namespace
 
+UseList::iterator::iterator(const UseList *list, size_t block, size_t pos, size_t end)
+    : list_(list), pos_(pos), end_(end) {
+  if (pos_ < end_ && list_->packed_) {
+    startBlock(block);
+    p_ = decode(p_, cur_);
+  }
+}
+
+void UseList::iterator::startBlock(size_t block) {
+  const Block &b = list_->packed_->blocks[block];
+  block_ = block;
+  block_end_ = pos_ + b.count;
+  p_ = list_->packed_->bytes.data() + b.offset;
+  cur_ = {};
+  cur_.range.start = {0, 0};
+  cur_.file_id = b.file_id;
+}
+
+namespace {
+uint32_t readVarint(const uint8_t *&p) {
+  uint32_t v = 0;
+  for (int shift = 0;; shift += 7) {
+    uint8_t c = *p++;
+    v |= uint32_t(c & 127) << shift;
+    if (c < 128)
+      return v;
+  }
+}
+
+void writeVarint(std::vector<uint8_t> &out, uint32_t v) {
+  for (; v >= 128; v >>= 7)
+    out.push_back(uint8_t(v | 128));
+  out.push_back(uint8_t(v));
+}
+
+int32_t unzigzag(uint32_t v) { return int32_t(v >> 1) ^ -int32_t(v & 1); }
+uint32_t zigzag(int32_t v) { return (uint32_t(v) << 1) ^ uint32_t(v >> 31); }
+} // namespace
+
+// A use is encoded relative to the previous one in the block: start.line
+// delta, start.column (delta if on the same line), end.line - start.line,
+// end.column (delta from start.column if on the same line), role.
+const uint8_t *UseList::decode(const uint8_t *p, Use &use) {
+  Range &r = use.range;
+  uint32_t dline = readVarint(p);
+  r.start.line += dline;
+  r.start.column = int16_t((dline ? 0 : r.start.column) + unzigzag(readVarint(p)));
+  r.end.line = uint16_t(r.start.line + unzigzag(readVarint(p)));
+  r.end.column = int16_t((r.end.line == r.start.line ? r.start.column : 0) + unzigzag(readVarint(p)));
+  use.role = Role(readVarint(p));
+  return p;
+}
+
+void UseList::encode(std::vector<uint8_t> &out, const Use &prev, const Use &use) {
+  const Range &r = use.range;
+  uint32_t dline = r.start.line - prev.range.start.line;
+  writeVarint(out, dline);
+  writeVarint(out, zigzag(r.start.column - (dline ? 0 : prev.range.start.column)));
+  writeVarint(out, zigzag(r.end.line - r.start.line));
+  writeVarint(out, zigzag(r.end.column - (r.end.line == r.start.line ? r.start.column : 0)));
+  writeVarint(out, uint32_t(use.role));
+}
+
+size_t UseList::heapBytes() const {
+  if (!packed_)
+    return plain_.capacity() * sizeof(Use);
+  return sizeof(Packed) + packed_->blocks.capacity() * sizeof(Block) + packed_->bytes.capacity();
+}
+
+void UseList::getFile(int file_id, std::vector<Use> &out) const {
+  out.clear();
+  if (!packed_) {
+    auto lo = std::lower_bound(plain_.begin(), plain_.end(), file_id,
+                               [](const Use &x, int id) { return x.file_id < id; });
+    auto hi = std::upper_bound(lo, plain_.end(), file_id, [](int id, const Use &x) { return id < x.file_id; });
+    out.assign(lo, hi);
+    return;
+  }
+  const std::vector<Block> &blocks = packed_->blocks;
+  auto b = std::lower_bound(blocks.begin(), blocks.end(), file_id,
+                            [](const Block &x, int id) { return x.file_id < id; });
+  if (b == blocks.end() || b->file_id != file_id)
+    return;
+  Use use;
+  use.range.start = {0, 0};
+  use.file_id = file_id;
+  const uint8_t *p = packed_->bytes.data() + b->offset;
+  for (uint32_t i = 0; i < b->count; i++) {
+    p = decode(p, use);
+    out.push_back(use);
+  }
+}
+
+void UseList::setFile(int file_id, const std::vector<Use> &uses, bool compress) {
+  if (empty()) {
+    plain_.clear();
+    packed_.reset(compress ? new Packed : nullptr);
+  }
+  if (!packed_) {
+    auto lo = std::lower_bound(plain_.begin(), plain_.end(), file_id,
+                               [](const Use &x, int id) { return x.file_id < id; });
+    auto hi = std::upper_bound(lo, plain_.end(), file_id, [](int id, const Use &x) { return id < x.file_id; });
+    size_t n = std::min<size_t>(uses.size(), hi - lo);
+    std::copy(uses.begin(), uses.begin() + n, lo);
+    if (uses.size() < size_t(hi - lo))
+      plain_.erase(lo + n, hi);
+    else
+      plain_.insert(hi, uses.begin() + n, uses.end());
+    return;
+  }
+
+  std::vector<uint8_t> enc;
+  Use prev;
+  prev.range.start = {0, 0};
+  for (const Use &use : uses) {
+    encode(enc, prev, use);
+    prev = use;
+  }
+  std::vector<Block> &blocks = packed_->blocks;
+  std::vector<uint8_t> &bytes = packed_->bytes;
+  size_t i = std::lower_bound(blocks.begin(), blocks.end(), file_id,
+                              [](const Block &x, int id) { return x.file_id < id; }) -
+             blocks.begin();
+  bool exists = i < blocks.size() && blocks[i].file_id == file_id;
+  size_t offset = i < blocks.size() ? blocks[i].offset : bytes.size();
+  size_t old_end = exists ? (i + 1 < blocks.size() ? blocks[i + 1].offset : bytes.size()) : offset;
+  size_t n = std::min(enc.size(), old_end - offset);
+  std::copy(enc.begin(), enc.begin() + n, bytes.begin() + offset);
+  if (enc.size() < old_end - offset)
+    bytes.erase(bytes.begin() + offset + n, bytes.begin() + old_end);
+  else
+    bytes.insert(bytes.begin() + old_end, enc.begin() + n, enc.end());
+  for (size_t j = exists ? i + 1 : i; j < blocks.size(); j++)
+    blocks[j].offset += enc.size() - (old_end - offset);
+
+  packed_->size -= exists ? blocks[i].count : 0;
+  packed_->size += uses.size();
+  if (uses.empty()) {
+    if (exists)
+      blocks.erase(blocks.begin() + i);
+  } else if (exists) {
+    blocks[i].count = uses.size();
+  } else {
+    blocks.insert(blocks.begin() + i, {file_id, uint32_t(uses.size()), uint32_t(offset)});
+  }
+  if (bytes.capacity() > 2 * bytes.size() + 64)
+    bytes.shrink_to_fit();
+}
+
+void UseList::splice(std::vector<Use> &to_remove, std::vector<Use> &to_add, bool compress) {
+  if (!packed_ && !(compress && empty())) {
+    spliceRange(plain_, to_remove, to_add);
+    return;
+  }
+  std::vector<Use> old, span;
+  eachFileDelta(to_remove, to_add, [&](int file_id, auto rem, auto rem_end, auto add, auto add_end) {
+    getFile(file_id, old);
+    spliceSpan(old.begin(), old.end(), rem, rem_end, add, add_end, span);
+    setFile(file_id, span, compress);
+  });
+}
+
+// Returns the index of the entity of |usr|, creating it if absent.
+template <typename Q>
+int getOrAdd(llvm::DenseMap<Usr, int, DenseMapInfoForUsr> &entity_usr, llvm::SmallVectorImpl<Q> &entities,
+             DB::Columns &cols, Usr usr) {
+  auto r = entity_usr.try_emplace(usr, entity_usr.size());
+  if (r.second) {
+    entities.emplace_back().usr = usr;
+    cols.add(usr);
+  }
+  return r.first->second;
+}
+
+// Translates the Usr of an Update<Usr> to entity indices. Removed entities
+// already exist; added ones are created if absent.
+template <typename Q>
+std::pair<std::vector<int>, std::vector<int>> toIds(llvm::DenseMap<Usr, int, DenseMapInfoForUsr> &entity_usr,
+                                                    llvm::SmallVectorImpl<Q> &entities, DB::Columns &cols,
+                                                    const std::pair<std::vector<Usr>, std::vector<Usr>> &p) {
+  std::pair<std::vector<int>, std::vector<int>> ret;
+  for (Usr usr : p.first) {
+    auto it = entity_usr.find(usr);
+    if (it != entity_usr.end())
+      ret.first.push_back(it->second);
+  }
+  for (Usr usr : p.second)
+    ret.second.push_back(getOrAdd(entity_usr, entities, cols, usr));
+  return ret;
+}
+
 template <typename T> Vec<T> convert(const std::vector<T> &o) {
   Vec<T> r{std::make_unique<T[]>(o.size()), (int)o.size()};
   std::copy(o.begin(), o.end(), r.begin());
   return r;
 }
 
-QueryFunc::Def convert(const IndexFunc::Def &o) {
-  QueryFunc::Def r;
+QueryFunc::UsrDef convert(const IndexFunc::Def &o) {
+  QueryFunc::UsrDef r;
   r.detailed_name = o.detailed_name;
   r.hover = o.hover;
   r.comments = o.comments;
@@ -91,8 +429,8 @@ QueryFunc::Def convert(const IndexFunc::Def &o) {
   return r;
 }
 
-QueryType::Def convert(const IndexType::Def &o) {
-  QueryType::Def r;
+QueryType::UsrDef convert(const IndexType::Def &o) {
+  QueryType::UsrDef r;
   r.detailed_name = o.detailed_name;
   r.hover = o.hover;
   r.comments = o.comments;
@@ -178,8 +516,95 @@ IndexUpdate IndexUpdate::createDelta(IndexFile *previous, IndexFile *current) {
   return r;
 }
 
+void IndexUpdate::merge(IndexUpdate &&next) {
+  lid2path = std::move(next.lid2path);
+  if (next.files_removed)
+    files_removed = std::move(next.files_removed);
+  files_def_update = std::move(next.files_def_update);
+
+  funcs_hint += next.funcs_hint;
+  funcs_def_update = std::move(next.funcs_def_update);
+  mergeUpdate(funcs_declarations, next.funcs_declarations);
+  mergeUpdate(funcs_uses, next.funcs_uses);
+  mergeUpdate(funcs_derived, next.funcs_derived);
+
+  types_hint += next.types_hint;
+  types_def_update = std::move(next.types_def_update);
+  mergeUpdate(types_declarations, next.types_declarations);
+  mergeUpdate(types_uses, next.types_uses);
+  mergeUpdate(types_derived, next.types_derived);
+  mergeUpdate(types_instances, next.types_instances);
+
+  vars_hint += next.vars_hint;
+  vars_def_update = std::move(next.vars_def_update);
+  mergeUpdate(vars_declarations, next.vars_declarations);
+  mergeUpdate(vars_uses, next.vars_uses);
+}
+
+int DB::Columns::add(Usr usr) {
+  this->usr.push_back(usr);
+  name.emplace_back();
+  name_mask.push_back(0);
+  kind.push_back(SymbolKind::Unknown);
+  parent_kind.push_back(SymbolKind::Unknown);
+  storage.push_back(clang::SC_None);
+  spell_file.push_back(-1);
+  local.push_back(1);
+  return this->usr.size() - 1;
+}
+
+template <typename Q> void DB::Columns::update(int idx, const Q &entity) {
+  uint64_t mask = 0;
+  for (auto &def : entity.def)
+    mask |= charMask(def.detailed_name);
+  name_mask[idx] = mask;
+  if (const auto *def = entity.anyDef()) {
+    name[idx] = {{}, def->detailed_name, def->qual_name_offset, def->short_name_offset, def->short_name_size};
+    kind[idx] = def->kind;
+    parent_kind[idx] = def->parent_kind;
+    if constexpr (!std::is_same_v<Q, QueryType>)
+      storage[idx] = def->storage;
+    spell_file[idx] = def->spell ? def->spell->file_id : -1;
+  } else {
+    name[idx] = {};
+    kind[idx] = parent_kind[idx] = SymbolKind::Unknown;
+    storage[idx] = clang::SC_None;
+    spell_file[idx] = -1;
+  }
+  if constexpr (std::is_same_v<Q, QueryVar>)
+    local[idx] = entity.def.empty() || entity.def[0].is_local();
+  else
+    local[idx] = entity.def.empty();
+}
+template void DB::Columns::update(int, const QueryFunc &);
+template void DB::Columns::update(int, const QueryType &);
+template void DB::Columns::update(int, const QueryVar &);
+
+void DB::Columns::reserve(size_t n) {
+  usr.reserve(n);
+  name.reserve(n);
+  name_mask.reserve(n);
+  kind.reserve(n);
+  parent_kind.reserve(n);
+  storage.reserve(n);
+  spell_file.reserve(n);
+  local.reserve(n);
+}
+
+void DB::Columns::clear() {
+  usr.clear();
+  name.clear();
+  name_mask.clear();
+  kind.clear();
+  parent_kind.clear();
+  storage.clear();
+  spell_file.clear();
+  local.clear();
+}
+
 void DB::clear() {
   files.clear();
+  file_paths.clear();
   name2file_id.clear();
   func_usr.clear();
   type_usr.clear();
@@ -187,6 +612,9 @@ void DB::clear() {
   funcs.clear();
   types.clear();
   vars.clear();
+  func_cols_.clear();
+  type_cols_.clear();
+  var_cols_.clear();
 }
 
 template <typename Def> void DB::removeUsrs(Kind kind, int file_id, const std::vector<std::pair<Usr, Def>> &to_remove) {
@@ -194,36 +622,45 @@ template <typename Def> void DB::removeUsrs(Kind kind, int file_id, const std::v
   case Kind::Func: {
     for (auto &[usr, _] : to_remove) {
       // FIXME
-      if (!hasFunc(usr))
+      auto idx = func_usr.find(usr);
+      if (idx == func_usr.end())
         continue;
-      QueryFunc &func = getFunc(usr);
+      QueryFunc &func = funcs[idx->second];
       auto it = llvm::find_if(func.def, [=](const QueryFunc::Def &def) { return def.file_id == file_id; });
-      if (it != func.def.end())
+      if (it != func.def.end()) {
         func.def.erase(it);
+        func_cols_.update(idx->second, func);
+      }
     }
     break;
   }
   case Kind::Type: {
     for (auto &[usr, _] : to_remove) {
       // FIXME
-      if (!hasType(usr))
+      auto idx = type_usr.find(usr);
+      if (idx == type_usr.end())
         continue;
-      QueryType &type = getType(usr);
+      QueryType &type = types[idx->second];
       auto it = llvm::find_if(type.def, [=](const QueryType::Def &def) { return def.file_id == file_id; });
-      if (it != type.def.end())
+      if (it != type.def.end()) {
         type.def.erase(it);
+        type_cols_.update(idx->second, type);
+      }
     }
     break;
   }
   case Kind::Var: {
     for (auto &[usr, _] : to_remove) {
       // FIXME
-      if (!hasVar(usr))
+      auto idx = var_usr.find(usr);
+      if (idx == var_usr.end())
         continue;
-      QueryVar &var = getVar(usr);
+      QueryVar &var = vars[idx->second];
       auto it = llvm::find_if(var.def, [=](const QueryVar::Def &def) { return def.file_id == file_id; });
-      if (it != var.def.end())
+      if (it != var.def.end()) {
         var.def.erase(it);
+        var_cols_.update(idx->second, var);
+      }
     }
     break;
   }
@@ -232,17 +669,44 @@ template <typename Def> void DB::removeUsrs(Kind kind, int file_id, const std::v
   }
 }
 
+namespace {
+// Remove |removed| from and merge |added| into QueryFile::sorted_syms, then
+// recompute max_ends. This costs a linear pass instead of a full sort.
+void updateSortedSyms(QueryFile &file, const std::vector<ExtentRef> &removed, std::vector<ExtentRef> &added) {
+  auto &syms = file.sorted_syms;
+  if (removed.size()) {
+    llvm::DenseSet<ExtentRef> set(removed.begin(), removed.end());
+    syms.erase(std::remove_if(syms.begin(), syms.end(), [&](const ExtentRef &sym) { return set.count(sym); }),
+               syms.end());
+  }
+  // A symbol may have disappeared and reappeared in the same update.
+  llvm::DenseSet<ExtentRef> seen;
+  added.erase(std::remove_if(added.begin(), added.end(),
+                             [&](const ExtentRef &sym) {
+                               return !file.symbol2refcnt.count(sym) || !seen.insert(sym).second;
+                             }),
+              added.end());
+  auto less = [](const ExtentRef &l, const ExtentRef &r) { return l.range.start < r.range.start; };
+  std::sort(added.begin(), added.end(), less);
+  size_t n = syms.size();
+  syms.insert(syms.end(), added.begin(), added.end());
+  std::inplace_merge(syms.begin(), syms.begin() + n, syms.end(), less);
+
+  file.max_ends.resize(syms.size());
+  Pos max_end;
+  for (size_t i = 0; i < syms.size(); i++) {
+    if (max_end < syms[i].range.end)
+      max_end = syms[i].range.end;
+    file.max_ends[i] = max_end;
+  }
+}
+} // namespace
+
 void DB::applyIndexUpdate(IndexUpdate *u) {
 #define REMOVE_ADD(C, F)                                                                                               \
   for (auto &it : u->C##s_##F) {                                                                                       \
-    auto r = C##_usr.try_emplace({it.first}, C##_usr.size());                                                          \
-    if (r.second) {                                                                                                    \
-      C##s.emplace_back();                                                                                             \
-      C##s.back().usr = it.first;                                                                                      \
-    }                                                                                                                  \
-    auto &entity = C##s[r.first->second];                                                                              \
-    removeRange(entity.F, it.second.first);                                                                            \
-    addRange(entity.F, it.second.second);                                                                              \
+    auto &entity = C##s[getOrAdd(C##_usr, C##s, C##_cols_, it.first)];                                                 \
+    spliceRange(entity.F, it.second.first, it.second.second);                                                          \
   }
 
   std::unordered_map<int, int> prev_lid2file_id, lid2file_id;
@@ -254,37 +718,33 @@ void DB::applyIndexUpdate(IndexUpdate *u) {
     if (!files[file_id].def) {
       files[file_id].def = QueryFile::Def();
       files[file_id].def->path = path;
+      file_paths[file_id] = intern(path);
     }
   }
 
+  bool compress_uses = g_config->index.compressUses;
+
+  // The func/type/var sections only touch their own entities and may be
+  // applied in parallel. Changes to symbol2refcnt are recorded per section and
+  // applied per file afterwards.
+  std::vector<RefcntDelta> func_refcnt, type_refcnt, var_refcnt;
+
   // References (Use &use) in this function are important to update file_id.
-  auto ref = [&](std::unordered_map<int, int> &lid2fid, Usr usr, Kind kind, Use &use, int delta) {
+  auto ref = [&](std::vector<RefcntDelta> &refcnt, std::unordered_map<int, int> &lid2fid, Usr usr, Kind kind,
+                 Use &use, int delta) {
     use.file_id = use.file_id == -1 ? u->file_id : lid2fid.find(use.file_id)->second;
-    ExtentRef sym{{use.range, usr, kind, use.role}};
-    int &v = files[use.file_id].symbol2refcnt[sym];
-    v += delta;
-    assert(v >= 0);
-    if (!v)
-      files[use.file_id].symbol2refcnt.erase(sym);
+    refcnt.push_back({use.file_id, delta, {{use.range, usr, kind, use.role}}});
   };
-  auto refDecl = [&](std::unordered_map<int, int> &lid2fid, Usr usr, Kind kind, DeclRef &dr, int delta) {
+  auto refDecl = [&](std::vector<RefcntDelta> &refcnt, std::unordered_map<int, int> &lid2fid, Usr usr, Kind kind,
+                     DeclRef &dr, int delta) {
     dr.file_id = dr.file_id == -1 ? u->file_id : lid2fid.find(dr.file_id)->second;
-    ExtentRef sym{{dr.range, usr, kind, dr.role}, dr.extent};
-    int &v = files[dr.file_id].symbol2refcnt[sym];
-    v += delta;
-    assert(v >= 0);
-    if (!v)
-      files[dr.file_id].symbol2refcnt.erase(sym);
+    refcnt.push_back({dr.file_id, delta, {{dr.range, usr, kind, dr.role}, dr.extent}});
   };
 
-  auto updateUses = [&](Usr usr, Kind kind, llvm::DenseMap<Usr, int, DenseMapInfoForUsr> &entity_usr, auto &entities,
+  auto updateUses = [&](std::vector<RefcntDelta> &refcnt, Usr usr, Kind kind,
+                        llvm::DenseMap<Usr, int, DenseMapInfoForUsr> &entity_usr, auto &entities, Columns &cols,
                         auto &p, bool hint_implicit) {
-    auto r = entity_usr.try_emplace(usr, entity_usr.size());
-    if (r.second) {
-      entities.emplace_back();
-      entities.back().usr = usr;
-    }
-    auto &entity = entities[r.first->second];
+    auto &entity = entities[getOrAdd(entity_usr, entities, cols, usr)];
     for (Use &use : p.first) {
       if (hint_implicit && use.role & Role::Implicit) {
         // Make ranges of implicit function calls larger (spanning one more
@@ -295,89 +755,156 @@ void DB::applyIndexUpdate(IndexUpdate *u) {
           use.range.start.column--;
         use.range.end.column++;
       }
-      ref(prev_lid2file_id, usr, kind, use, -1);
+      ref(refcnt, prev_lid2file_id, usr, kind, use, -1);
     }
-    removeRange(entity.uses, p.first);
     for (Use &use : p.second) {
       if (hint_implicit && use.role & Role::Implicit) {
         if (use.range.start.column > 0)
           use.range.start.column--;
         use.range.end.column++;
       }
-      ref(lid2file_id, usr, kind, use, 1);
+      ref(refcnt, lid2file_id, usr, kind, use, 1);
     }
-    addRange(entity.uses, p.second);
+    entity.uses.splice(p.first, p.second, compress_uses);
   };
 
-  if (u->files_removed)
-    files[name2file_id[lowerPathIfInsensitive(*u->files_removed)]].def = std::nullopt;
+  if (u->files_removed) {
+    int file_id = name2file_id[lowerPathIfInsensitive(*u->files_removed)];
+    files[file_id].def = std::nullopt;
+    file_paths[file_id] = nullptr;
+  }
   u->file_id = u->files_def_update ? update(std::move(*u->files_def_update)) : -1;
 
   const double grow = 1.3;
-  size_t t;
-
-  if ((t = funcs.size() + u->funcs_hint) > funcs.capacity()) {
-    t = size_t(t * grow);
-    funcs.reserve(t);
-    func_usr.reserve(t);
-  }
-  for (auto &[usr, def] : u->funcs_removed)
-    if (def.spell)
-      refDecl(prev_lid2file_id, usr, Kind::Func, *def.spell, -1);
-  removeUsrs(Kind::Func, u->file_id, u->funcs_removed);
-  update(lid2file_id, u->file_id, std::move(u->funcs_def_update));
-  for (auto &[usr, del_add] : u->funcs_declarations) {
-    for (DeclRef &dr : del_add.first)
-      refDecl(prev_lid2file_id, usr, Kind::Func, dr, -1);
-    for (DeclRef &dr : del_add.second)
-      refDecl(lid2file_id, usr, Kind::Func, dr, 1);
-  }
-  REMOVE_ADD(func, declarations);
-  REMOVE_ADD(func, derived);
-  for (auto &[usr, p] : u->funcs_uses)
-    updateUses(usr, Kind::Func, func_usr, funcs, p, true);
-
-  if ((t = types.size() + u->types_hint) > types.capacity()) {
-    t = size_t(t * grow);
-    types.reserve(t);
-    type_usr.reserve(t);
-  }
-  for (auto &[usr, def] : u->types_removed)
-    if (def.spell)
-      refDecl(prev_lid2file_id, usr, Kind::Type, *def.spell, -1);
-  removeUsrs(Kind::Type, u->file_id, u->types_removed);
-  update(lid2file_id, u->file_id, std::move(u->types_def_update));
-  for (auto &[usr, del_add] : u->types_declarations) {
-    for (DeclRef &dr : del_add.first)
-      refDecl(prev_lid2file_id, usr, Kind::Type, dr, -1);
-    for (DeclRef &dr : del_add.second)
-      refDecl(lid2file_id, usr, Kind::Type, dr, 1);
-  }
-  REMOVE_ADD(type, declarations);
-  REMOVE_ADD(type, derived);
-  REMOVE_ADD(type, instances);
-  for (auto &[usr, p] : u->types_uses)
-    updateUses(usr, Kind::Type, type_usr, types, p, false);
-
-  if ((t = vars.size() + u->vars_hint) > vars.capacity()) {
-    t = size_t(t * grow);
-    vars.reserve(t);
-    var_usr.reserve(t);
-  }
-  for (auto &[usr, def] : u->vars_removed)
-    if (def.spell)
-      refDecl(prev_lid2file_id, usr, Kind::Var, *def.spell, -1);
-  removeUsrs(Kind::Var, u->file_id, u->vars_removed);
-  update(lid2file_id, u->file_id, std::move(u->vars_def_update));
-  for (auto &[usr, del_add] : u->vars_declarations) {
-    for (DeclRef &dr : del_add.first)
-      refDecl(prev_lid2file_id, usr, Kind::Var, dr, -1);
-    for (DeclRef &dr : del_add.second)
-      refDecl(lid2file_id, usr, Kind::Var, dr, 1);
-  }
-  REMOVE_ADD(var, declarations);
-  for (auto &[usr, p] : u->vars_uses)
-    updateUses(usr, Kind::Var, var_usr, vars, p, false);
+
+  auto applyFuncs = [&]() {
+    size_t t;
+    if ((t = funcs.size() + u->funcs_hint) > funcs.capacity()) {
+      t = size_t(t * grow);
+      funcs.reserve(t);
+      func_usr.reserve(t);
+      func_cols_.reserve(t);
+    }
+    for (auto &[usr, def] : u->funcs_removed)
+      if (def.spell)
+        refDecl(func_refcnt, prev_lid2file_id, usr, Kind::Func, *def.spell, -1);
+    removeUsrs(Kind::Func, u->file_id, u->funcs_removed);
+    for (auto &[usr, del_add] : u->funcs_declarations) {
+      for (DeclRef &dr : del_add.first)
+        refDecl(func_refcnt, prev_lid2file_id, usr, Kind::Func, dr, -1);
+      for (DeclRef &dr : del_add.second)
+        refDecl(func_refcnt, lid2file_id, usr, Kind::Func, dr, 1);
+    }
+    REMOVE_ADD(func, declarations);
+    for (auto &[usr, p] : u->funcs_derived) {
+      auto [rem, add] = toIds(func_usr, funcs, func_cols_, p);
+      spliceRange(funcs[getOrAdd(func_usr, funcs, func_cols_, usr)].derived, rem, add);
+    }
+    for (auto &[usr, p] : u->funcs_uses)
+      updateUses(func_refcnt, usr, Kind::Func, func_usr, funcs, func_cols_, p, true);
+  };
+
+  auto applyTypes = [&]() {
+    size_t t;
+    if ((t = types.size() + u->types_hint) > types.capacity()) {
+      t = size_t(t * grow);
+      types.reserve(t);
+      type_usr.reserve(t);
+      type_cols_.reserve(t);
+    }
+    for (auto &[usr, def] : u->types_removed)
+      if (def.spell)
+        refDecl(type_refcnt, prev_lid2file_id, usr, Kind::Type, *def.spell, -1);
+    removeUsrs(Kind::Type, u->file_id, u->types_removed);
+    for (auto &[usr, del_add] : u->types_declarations) {
+      for (DeclRef &dr : del_add.first)
+        refDecl(type_refcnt, prev_lid2file_id, usr, Kind::Type, dr, -1);
+      for (DeclRef &dr : del_add.second)
+        refDecl(type_refcnt, lid2file_id, usr, Kind::Type, dr, 1);
+    }
+    REMOVE_ADD(type, declarations);
+    for (auto &[usr, p] : u->types_derived) {
+      auto [rem, add] = toIds(type_usr, types, type_cols_, p);
+      spliceRange(types[getOrAdd(type_usr, types, type_cols_, usr)].derived, rem, add);
+    }
+    for (auto &[usr, p] : u->types_uses)
+      updateUses(type_refcnt, usr, Kind::Type, type_usr, types, type_cols_, p, false);
+  };
+
+  auto applyVars = [&]() {
+    size_t t;
+    if ((t = vars.size() + u->vars_hint) > vars.capacity()) {
+      t = size_t(t * grow);
+      vars.reserve(t);
+      var_usr.reserve(t);
+      var_cols_.reserve(t);
+    }
+    for (auto &[usr, def] : u->vars_removed)
+      if (def.spell)
+        refDecl(var_refcnt, prev_lid2file_id, usr, Kind::Var, *def.spell, -1);
+    removeUsrs(Kind::Var, u->file_id, u->vars_removed);
+    update(lid2file_id, u->file_id, std::move(u->vars_def_update), var_refcnt);
+    for (auto &[usr, del_add] : u->vars_declarations) {
+      for (DeclRef &dr : del_add.first)
+        refDecl(var_refcnt, prev_lid2file_id, usr, Kind::Var, dr, -1);
+      for (DeclRef &dr : del_add.second)
+        refDecl(var_refcnt, lid2file_id, usr, Kind::Var, dr, 1);
+    }
+    REMOVE_ADD(var, declarations);
+    for (auto &[usr, p] : u->vars_uses)
+      updateUses(var_refcnt, usr, Kind::Var, var_usr, vars, var_cols_, p, false);
+  };
+
+  // Handing the sections to other threads only pays off for large updates,
+  // e.g. a translation unit including many headers.
+  if (u->funcs_uses.size() + u->types_uses.size() + u->vars_uses.size() < kParallelApplyThreshold) {
+    applyFuncs();
+    applyTypes();
+    applyVars();
+  } else {
+    applyPool().run(3, [&](int i) { i == 0 ? applyVars() : i == 1 ? applyFuncs() : applyTypes(); });
+  }
+  // Func and type defs and instances refer to entities of other sections.
+  update(lid2file_id, u->file_id, std::move(u->funcs_def_update), func_refcnt);
+  update(lid2file_id, u->file_id, std::move(u->types_def_update), type_refcnt);
+  for (auto &[usr, p] : u->types_instances) {
+    auto [rem, add] = toIds(var_usr, vars, var_cols_, p);
+    spliceRange(types[getOrAdd(type_usr, types, type_cols_, usr)].instances, rem, add);
+  }
+
+  // Deltas of one file are applied in order by the same shard, so a count
+  // never drops below zero. The shard then updates sorted_syms of the files
+  // whose symbol set has changed.
+  auto applyRefcnt = [&](int shard, int n_shards) {
+    // file_id => symbols which disappeared and appeared
+    std::unordered_map<int, std::pair<std::vector<ExtentRef>, std::vector<ExtentRef>>> changed;
+    for (auto *refcnt : {&func_refcnt, &type_refcnt, &var_refcnt})
+      for (RefcntDelta &d : *refcnt) {
+        if (d.file_id % n_shards != shard)
+          continue;
+        auto &symbol2refcnt = files[d.file_id].symbol2refcnt;
+        int &v = symbol2refcnt[d.sym];
+        bool present = v > 0;
+        v += d.delta;
+        assert(v >= 0);
+        if (!v) {
+          symbol2refcnt.erase(d.sym);
+          if (present)
+            changed[d.file_id].first.push_back(d.sym);
+        } else if (!present) {
+          changed[d.file_id].second.push_back(d.sym);
+        }
+      }
+    for (auto &[file_id, p] : changed)
+      updateSortedSyms(files[file_id], p.first, p.second);
+  };
+  size_t n_refcnt = func_refcnt.size() + type_refcnt.size() + var_refcnt.size();
+  int n_shards = std::min<int>(std::thread::hardware_concurrency(), 8);
+  if (n_refcnt < kParallelApplyThreshold * 8 || lid2file_id.empty() || n_shards < 2) {
+    applyRefcnt(0, 1);
+  } else {
+    applyPool().run(n_shards, [&](int i) { applyRefcnt(i, n_shards); });
+  }
 
 #undef REMOVE_ADD
 }
@@ -387,6 +914,7 @@ int DB::getFileId(const std::string &path) {
   if (it.second) {
     int id = files.size();
     it.first->second = files.emplace_back().id = id;
+    file_paths.push_back(nullptr);
   }
   return it.first->second;
 }
@@ -394,67 +922,143 @@ int DB::getFileId(const std::string &path) {
 int DB::update(QueryFile::DefUpdate &&u) {
   int file_id = getFileId(u.first.path);
   files[file_id].def = u.first;
+  file_paths[file_id] = intern(u.first.path);
   return file_id;
 }
 
-void DB::update(const Lid2file_id &lid2file_id, int file_id, std::vector<std::pair<Usr, QueryFunc::Def>> &&us) {
+int DB::entityId(Kind kind, Usr usr) {
+  switch (kind) {
+  case Kind::Func:
+    return getOrAdd(func_usr, funcs, func_cols_, usr);
+  case Kind::Type:
+    return getOrAdd(type_usr, types, type_cols_, usr);
+  case Kind::Var:
+    return getOrAdd(var_usr, vars, var_cols_, usr);
+  default:
+    return -1;
+  }
+}
+
+void DB::updateColumns() {
+  for (size_t i = 0; i < funcs.size(); i++)
+    func_cols_.update(i, funcs[i]);
+  for (size_t i = 0; i < types.size(); i++)
+    type_cols_.update(i, types[i]);
+  for (size_t i = 0; i < vars.size(); i++)
+    var_cols_.update(i, vars[i]);
+}
+
+namespace {
+Vec<int> toIds(DB &db, Kind kind, const Vec<Usr> &usrs) {
+  Vec<int> r{std::make_unique<int[]>(usrs.size()), usrs.size()};
+  for (int i = 0; i < usrs.size(); i++)
+    r[i] = db.entityId(kind, usrs[i]);
+  return r;
+}
+
+QueryFunc::Def toIds(DB &db, const QueryFunc::UsrDef &o) {
+  QueryFunc::Def r;
+  r.detailed_name = o.detailed_name;
+  r.hover = o.hover;
+  r.comments = o.comments;
+  r.spell = o.spell;
+  r.bases = toIds(db, Kind::Func, o.bases);
+  r.vars = toIds(db, Kind::Var, o.vars);
+  r.callees = {std::make_unique<EntityRef[]>(o.callees.size()), o.callees.size()};
+  for (int i = 0; i < o.callees.size(); i++) {
+    const SymbolRef &sym = o.callees[i];
+    r.callees[i] = {sym.range, db.entityId(sym.kind, sym.usr), sym.kind, sym.role};
+  }
+  r.file_id = o.file_id;
+  r.qual_name_offset = o.qual_name_offset;
+  r.short_name_offset = o.short_name_offset;
+  r.short_name_size = o.short_name_size;
+  r.kind = o.kind;
+  r.parent_kind = o.parent_kind;
+  r.storage = o.storage;
+  return r;
+}
+
+QueryType::Def toIds(DB &db, const QueryType::UsrDef &o) {
+  QueryType::Def r;
+  r.detailed_name = o.detailed_name;
+  r.hover = o.hover;
+  r.comments = o.comments;
+  r.spell = o.spell;
+  r.bases = toIds(db, Kind::Type, o.bases);
+  r.funcs = toIds(db, Kind::Func, o.funcs);
+  r.types = toIds(db, Kind::Type, o.types);
+  r.vars = {std::make_unique<std::pair<int, int64_t>[]>(o.vars.size()), o.vars.size()};
+  for (int i = 0; i < o.vars.size(); i++)
+    r.vars[i] = {db.entityId(Kind::Var, o.vars[i].first), o.vars[i].second};
+  r.alias_of = o.alias_of;
+  r.file_id = o.file_id;
+  r.qual_name_offset = o.qual_name_offset;
+  r.short_name_offset = o.short_name_offset;
+  r.short_name_size = o.short_name_size;
+  r.kind = o.kind;
+  r.parent_kind = o.parent_kind;
+  return r;
+}
+} // namespace
+
+void DB::update(const Lid2file_id &lid2file_id, int file_id, std::vector<std::pair<Usr, QueryFunc::UsrDef>> &&us,
+                std::vector<RefcntDelta> &refcnt) {
   for (auto &u : us) {
     auto &def = u.second;
     assert(def.detailed_name[0]);
     u.second.file_id = file_id;
     if (def.spell) {
       assignFileId(lid2file_id, file_id, *def.spell);
-      files[def.spell->file_id]
-          .symbol2refcnt[{{def.spell->range, u.first, Kind::Func, def.spell->role}, def.spell->extent}]++;
+      refcnt.push_back(
+          {def.spell->file_id, 1, {{def.spell->range, u.first, Kind::Func, def.spell->role}, def.spell->extent}});
     }
 
-    auto r = func_usr.try_emplace({u.first}, func_usr.size());
-    if (r.second)
-      funcs.emplace_back();
-    QueryFunc &existing = funcs[r.first->second];
-    existing.usr = u.first;
-    if (!tryReplaceDef(existing.def, std::move(def)))
-      existing.def.push_back(std::move(def));
+    QueryFunc::Def def1 = toIds(*this, def);
+    int idx = getOrAdd(func_usr, funcs, func_cols_, u.first);
+    QueryFunc &existing = funcs[idx];
+    if (!tryReplaceDef(existing.def, std::move(def1)))
+      existing.def.push_back(std::move(def1));
+    func_cols_.update(idx, existing);
   }
 }
 
-void DB::update(const Lid2file_id &lid2file_id, int file_id, std::vector<std::pair<Usr, QueryType::Def>> &&us) {
+void DB::update(const Lid2file_id &lid2file_id, int file_id, std::vector<std::pair<Usr, QueryType::UsrDef>> &&us,
+                std::vector<RefcntDelta> &refcnt) {
   for (auto &u : us) {
     auto &def = u.second;
     assert(def.detailed_name[0]);
     u.second.file_id = file_id;
     if (def.spell) {
       assignFileId(lid2file_id, file_id, *def.spell);
-      files[def.spell->file_id]
-          .symbol2refcnt[{{def.spell->range, u.first, Kind::Type, def.spell->role}, def.spell->extent}]++;
+      refcnt.push_back(
+          {def.spell->file_id, 1, {{def.spell->range, u.first, Kind::Type, def.spell->role}, def.spell->extent}});
     }
-    auto r = type_usr.try_emplace({u.first}, type_usr.size());
-    if (r.second)
-      types.emplace_back();
-    QueryType &existing = types[r.first->second];
-    existing.usr = u.first;
-    if (!tryReplaceDef(existing.def, std::move(def)))
-      existing.def.push_back(std::move(def));
+    QueryType::Def def1 = toIds(*this, def);
+    int idx = getOrAdd(type_usr, types, type_cols_, u.first);
+    QueryType &existing = types[idx];
+    if (!tryReplaceDef(existing.def, std::move(def1)))
+      existing.def.push_back(std::move(def1));
+    type_cols_.update(idx, existing);
   }
 }
 
-void DB::update(const Lid2file_id &lid2file_id, int file_id, std::vector<std::pair<Usr, QueryVar::Def>> &&us) {
+void DB::update(const Lid2file_id &lid2file_id, int file_id, std::vector<std::pair<Usr, QueryVar::Def>> &&us,
+                std::vector<RefcntDelta> &refcnt) {
   for (auto &u : us) {
     auto &def = u.second;
     assert(def.detailed_name[0]);
     u.second.file_id = file_id;
     if (def.spell) {
       assignFileId(lid2file_id, file_id, *def.spell);
-      files[def.spell->file_id]
-          .symbol2refcnt[{{def.spell->range, u.first, Kind::Var, def.spell->role}, def.spell->extent}]++;
+      refcnt.push_back(
+          {def.spell->file_id, 1, {{def.spell->range, u.first, Kind::Var, def.spell->role}, def.spell->extent}});
     }
-    auto r = var_usr.try_emplace({u.first}, var_usr.size());
-    if (r.second)
-      vars.emplace_back();
-    QueryVar &existing = vars[r.first->second];
-    existing.usr = u.first;
+    int idx = getOrAdd(var_usr, vars, var_cols_, u.first);
+    QueryVar &existing = vars[idx];
     if (!tryReplaceDef(existing.def, std::move(def)))
       existing.def.push_back(std::move(def));
+    var_cols_.update(idx, existing);
   }
 }
 
@@ -468,17 +1072,11 @@ std::string_view DB::getSymbolName(SymbolIdx sym, bool qualified) {
       return files[usr].def->path;
     break;
   case Kind::Func:
-    if (const auto *def = getFunc(usr).anyDef())
-      return def->name(qualified);
-    break;
+    return func_cols_.name[func_usr[usr]].name(qualified);
   case Kind::Type:
-    if (const auto *def = getType(usr).anyDef())
-      return def->name(qualified);
-    break;
+    return type_cols_.name[type_usr[usr]].name(qualified);
   case Kind::Var:
-    if (const auto *def = getVar(usr).anyDef())
-      return def->name(qualified);
-    break;
+    return var_cols_.name[var_usr[usr]].name(qualified);
   }
   return "";
 }
@@ -487,17 +1085,13 @@ std::vector<uint8_t> DB::getFileSet(const std::vector<std::string> &folders) {
   if (folders.empty())
     return std::vector<uint8_t>(files.size(), 1);
   std::vector<uint8_t> file_set(files.size());
-  for (QueryFile &file : files)
-    if (file.def) {
-      bool ok = false;
+  for (size_t i = 0; i < file_paths.size(); i++)
+    if (const char *path = file_paths[i])
       for (auto &folder : folders)
-        if (llvm::StringRef(file.def->path).startswith(folder)) {
-          ok = true;
+        if (llvm::StringRef(path).startswith(folder)) {
+          file_set[i] = 1;
           break;
         }
-      if (ok)
-        file_set[file.id] = 1;
-    }
   return file_set;
 }
 
@@ -509,13 +1103,11 @@ int computeRangeSize(const Range &range) {
   return range.end.column - range.start.column;
 }
 
-template <typename Q, typename C>
-std::vector<Use> getDeclarations(llvm::DenseMap<Usr, int, DenseMapInfoForUsr> &entity_usr,
-                                 llvm::SmallVectorImpl<Q> &entities, const C &usrs) {
+template <typename Q, typename C> std::vector<Use> getDeclarations(llvm::SmallVectorImpl<Q> &entities, const C &ids) {
   std::vector<Use> ret;
-  ret.reserve(usrs.size());
-  for (Usr usr : usrs) {
-    Q &entity = entities[entity_usr[{usr}]];
+  ret.reserve(ids.size());
+  for (int id : ids) {
+    Q &entity = entities[id];
     bool has_def = false;
     for (auto &def : entity.def)
       if (def.spell) {
@@ -536,20 +1128,14 @@ Maybe<DeclRef> getDefinitionSpell(DB *db, SymbolIdx sym) {
   return ret;
 }
 
-std::vector<Use> getFuncDeclarations(DB *db, const std::vector<Usr> &usrs) {
-  return getDeclarations(db->func_usr, db->funcs, usrs);
-}
-std::vector<Use> getFuncDeclarations(DB *db, const Vec<Usr> &usrs) {
-  return getDeclarations(db->func_usr, db->funcs, usrs);
-}
-std::vector<Use> getTypeDeclarations(DB *db, const std::vector<Usr> &usrs) {
-  return getDeclarations(db->type_usr, db->types, usrs);
-}
-std::vector<DeclRef> getVarDeclarations(DB *db, const std::vector<Usr> &usrs, unsigned kind) {
+std::vector<Use> getFuncDeclarations(DB *db, const std::vector<int> &ids) { return getDeclarations(db->funcs, ids); }
+std::vector<Use> getFuncDeclarations(DB *db, const Vec<int> &ids) { return getDeclarations(db->funcs, ids); }
+std::vector<Use> getTypeDeclarations(DB *db, const std::vector<int> &ids) { return getDeclarations(db->types, ids); }
+std::vector<DeclRef> getVarDeclarations(DB *db, const std::vector<int> &ids, unsigned kind) {
   std::vector<DeclRef> ret;
-  ret.reserve(usrs.size());
-  for (Usr usr : usrs) {
-    QueryVar &var = db->getVar(usr);
+  ret.reserve(ids.size());
+  for (int id : ids) {
+    QueryVar &var = db->vars[id];
     bool has_def = false;
     for (auto &def : var.def)
       if (def.spell) {
@@ -762,9 +1348,17 @@ std::vector<SymbolRef> findSymbolsAtLocation(WorkingFile *wfile, QueryFile *file
     }
   }
 
-  for (auto [sym, refcnt] : file->symbol2refcnt)
-    if (refcnt > 0 && sym.range.contains(ls_pos.line, ls_pos.character))
-      symbols.push_back(sym);
+  // Walk back from the last range starting at or before the position until no
+  // earlier range can reach it.
+  if (ls_pos.line >= 0 && ls_pos.line <= UINT16_MAX) {
+    Pos pos{(uint16_t)ls_pos.line, (int16_t)std::min<int>(ls_pos.character, INT16_MAX)};
+    size_t i = std::upper_bound(file->sorted_syms.begin(), file->sorted_syms.end(), pos,
+                                [](Pos pos, const SymbolRef &sym) { return pos < sym.range.start; }) -
+               file->sorted_syms.begin();
+    while (i-- && pos < file->max_ends[i])
+      if (file->sorted_syms[i].range.contains(ls_pos.line, ls_pos.character))
+        symbols.push_back(file->sorted_syms[i]);
+  }
 
   // Order shorter ranges first, since they are more detailed/precise. This is
   // important for macros which generate code so that we can resolving the
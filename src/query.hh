@@ -40,6 +40,17 @@ struct QueryFile {
   std::optional<Def> def;
   // `extent` is valid => declaration; invalid => regular reference
   llvm::DenseMap<ExtentRef, int> symbol2refcnt;
+  // Keys of symbol2refcnt sorted by range.start and the running maximum of
+  // range.end, for findSymbolsAtLocation. Maintained by applyIndexUpdate.
+  std::vector<ExtentRef> sorted_syms;
+  std::vector<Pos> max_ends;
+};
+
+// A change to QueryFile::symbol2refcnt.
+struct RefcntDelta {
+  int file_id;
+  int delta;
+  ExtentRef sym;
 };
 
 template <typename Q, typename QDef> struct QueryEntity {
@@ -56,30 +67,140 @@ template <typename Q, typename QDef> struct QueryEntity {
   const Def *anyDef() const { return const_cast<QueryEntity *>(this)->anyDef(); }
 };
 
+// The uses of an entity, sorted by (file_id, range, role). If compression is
+// requested when a list is first filled (index.compressUses), the uses of each
+// file are stored as a block of varint-encoded deltas, a few bytes per use
+// instead of sizeof(Use). Iteration decodes on the fly, so the iterator owns
+// the Use it points to. Only one representation is populated: an uncompressed
+// list is a SmallVector (the same 24 bytes as a std::vector<Use>), while the
+// blocks of a compressed list live behind a single pointer.
+class UseList {
+  struct Block {
+    int file_id;
+    uint32_t count, offset;
+  };
+  struct Packed {
+    std::vector<Block> blocks;
+    std::vector<uint8_t> bytes;
+    uint32_t size = 0;
+  };
+
+public:
+  class iterator {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Use;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Use *;
+    using reference = const Use &;
+
+    reference operator*() const { return list_->packed_ ? cur_ : list_->plain_[pos_]; }
+    pointer operator->() const { return &**this; }
+    iterator &operator++() {
+      if (++pos_ < end_ && list_->packed_) {
+        if (pos_ == block_end_)
+          startBlock(block_ + 1);
+        p_ = decode(p_, cur_);
+      }
+      return *this;
+    }
+    bool operator==(const iterator &o) const { return list_ == o.list_ && pos_ == o.pos_; }
+    bool operator!=(const iterator &o) const { return !(*this == o); }
+
+  private:
+    friend class UseList;
+    iterator(const UseList *list, size_t block, size_t pos, size_t end);
+    void startBlock(size_t block);
+
+    const UseList *list_;
+    size_t pos_, end_, block_ = 0, block_end_ = 0;
+    const uint8_t *p_ = nullptr;
+    Use cur_;
+  };
+
+  iterator begin() const { return {this, 0, 0, size()}; }
+  iterator end() const { return {this, 0, size(), size()}; }
+  size_t size() const { return packed_ ? packed_->size : plain_.size(); }
+  bool empty() const { return size() == 0; }
+  // Heap memory owned by the list, excluding sizeof(UseList).
+  size_t heapBytes() const;
+
+  // Call |fn| with the file_id and the iterator range of each file.
+  template <typename Fn> void eachFile(Fn &&fn) const;
+  // Get/replace the uses in |file_id|, which are sorted by range.
+  void getFile(int file_id, std::vector<Use> &out) const;
+  void setFile(int file_id, const std::vector<Use> &uses, bool compress);
+  // Remove |to_remove| and add |to_add|, which are sorted in place.
+  void splice(std::vector<Use> &to_remove, std::vector<Use> &to_add, bool compress);
+
+private:
+  static const uint8_t *decode(const uint8_t *p, Use &use);
+  static void encode(std::vector<uint8_t> &out, const Use &prev, const Use &use);
+
+  llvm::SmallVector<Use, 0> plain_;
+  std::unique_ptr<Packed> packed_;
+};
+
+template <typename Fn> void UseList::eachFile(Fn &&fn) const {
+  if (!packed_) {
+    for (size_t first = 0; first < plain_.size();) {
+      int file_id = plain_[first].file_id;
+      size_t last = first + 1;
+      while (last < plain_.size() && plain_[last].file_id == file_id)
+        last++;
+      fn(file_id, iterator(this, 0, first, last), iterator(this, 0, last, last));
+      first = last;
+    }
+    return;
+  }
+  const std::vector<Block> &blocks = packed_->blocks;
+  size_t first = 0;
+  for (size_t i = 0; i < blocks.size(); i++) {
+    size_t last = first + blocks[i].count;
+    fn(blocks[i].file_id, iterator(this, i, first, last), iterator(this, i, last, last));
+    first = last;
+  }
+}
+
 template <typename T> using Update = std::unordered_map<Usr, std::pair<std::vector<T>, std::vector<T>>>;
 
-struct QueryFunc : QueryEntity<QueryFunc, FuncDef<Vec>> {
+// Like SymbolRef, but refers to the entity by its index in DB::funcs, DB::types
+// or DB::vars.
+struct EntityRef {
+  Range range;
+  int id;
+  Kind kind;
+  Role role;
+};
+
+// The defs of the DB refer to other entities by index. UsrDef is the def of an
+// IndexUpdate, which refers to them by Usr until DB::update translates it.
+struct QueryFunc : QueryEntity<QueryFunc, FuncDef<Vec, int, EntityRef>> {
+  using UsrDef = FuncDef<Vec>;
   Usr usr;
   llvm::SmallVector<Def, 1> def;
   std::vector<DeclRef> declarations;
-  std::vector<Usr> derived;
-  std::vector<Use> uses;
+  // Indices into DB::funcs.
+  std::vector<int> derived;
+  UseList uses;
 };
 
-struct QueryType : QueryEntity<QueryType, TypeDef<Vec>> {
+struct QueryType : QueryEntity<QueryType, TypeDef<Vec, int>> {
+  using UsrDef = TypeDef<Vec>;
   Usr usr;
   llvm::SmallVector<Def, 1> def;
   std::vector<DeclRef> declarations;
-  std::vector<Usr> derived;
-  std::vector<Usr> instances;
-  std::vector<Use> uses;
+  // Indices into DB::types and DB::vars.
+  std::vector<int> derived;
+  std::vector<int> instances;
+  UseList uses;
 };
 
 struct QueryVar : QueryEntity<QueryVar, VarDef> {
   Usr usr;
   llvm::SmallVector<Def, 1> def;
   std::vector<DeclRef> declarations;
-  std::vector<Use> uses;
+  UseList uses;
 };
 
 struct IndexUpdate {
@@ -87,6 +208,10 @@ struct IndexUpdate {
   // no delta computation should be done just pass null for previous.
   static IndexUpdate createDelta(IndexFile *previous, IndexFile *current);
 
+  // Merges the next update of the same file, whose previous IndexFile is the
+  // current IndexFile of this update.
+  void merge(IndexUpdate &&next);
+
   int file_id;
 
   // Dummy one to refresh all semantic highlight.
@@ -101,16 +226,16 @@ struct IndexUpdate {
 
   // Function updates.
   int funcs_hint;
-  std::vector<std::pair<Usr, QueryFunc::Def>> funcs_removed;
-  std::vector<std::pair<Usr, QueryFunc::Def>> funcs_def_update;
+  std::vector<std::pair<Usr, QueryFunc::UsrDef>> funcs_removed;
+  std::vector<std::pair<Usr, QueryFunc::UsrDef>> funcs_def_update;
   Update<DeclRef> funcs_declarations;
   Update<Use> funcs_uses;
   Update<Usr> funcs_derived;
 
   // Type updates.
   int types_hint;
-  std::vector<std::pair<Usr, QueryType::Def>> types_removed;
-  std::vector<std::pair<Usr, QueryType::Def>> types_def_update;
+  std::vector<std::pair<Usr, QueryType::UsrDef>> types_removed;
+  std::vector<std::pair<Usr, QueryType::UsrDef>> types_def_update;
   Update<DeclRef> types_declarations;
   Update<Use> types_uses;
   Update<Usr> types_derived;
@@ -137,22 +262,75 @@ using Lid2file_id = std::unordered_map<int, int>;
 // in-memory.
 struct DB {
   llvm::SmallVector<QueryFile, 0> files;
+  // Interned files[i].def->path, or nullptr if def is empty, so that
+  // getFileSet does not touch the files.
+  std::vector<const char *> file_paths;
   llvm::StringMap<int> name2file_id;
   llvm::DenseMap<Usr, int, DenseMapInfoForUsr> func_usr, type_usr, var_usr;
   llvm::SmallVector<QueryFunc, 0> funcs;
   llvm::SmallVector<QueryType, 0> types;
   llvm::SmallVector<QueryVar, 0> vars;
 
+  // Hot fields of funcs/types/vars in parallel arrays indexed like the entity
+  // vectors, so that scans over all entities (e.g. workspace/symbol) and
+  // semantic highlighting touch a few bytes per entity instead of the entities
+  // and their defs. The fields other than name_mask and local are those of
+  // anyDef(), or the defaults if def is empty.
+  //
+  // The columns duplicate the defs at about 40 bytes per entity (usr 8, name
+  // 16, name_mask 8, kind and parent_kind 2, storage 1, spell_file 4, local 1),
+  // e.g. 40 MB for a million entities. They are read-only outside of DB:
+  // Columns::update is their only writer after add, and is called whenever def
+  // of an entity changes.
+  struct Columns {
+    struct Name : NameMixin<Name> {
+      const char *detailed_name = "";
+      int16_t qual_name_offset = 0;
+      int16_t short_name_offset = 0;
+      int16_t short_name_size = 0;
+    };
+
+    std::vector<Usr> usr;
+    std::vector<Name> name;
+    // A superset of the characters in the names of def, see charMask. An
+    // entity can be skipped if it does not cover the mask of the query.
+    std::vector<uint64_t> name_mask;
+    std::vector<SymbolKind> kind, parent_kind;
+    // SC_None for types.
+    std::vector<uint8_t> storage;
+    // file_id of the spelling, or -1 if anyDef() is not a definition.
+    std::vector<int> spell_file;
+    // Whether def is empty or def[0] is a local variable.
+    std::vector<uint8_t> local;
+
+    int add(Usr usr);
+    template <typename Q> void update(int idx, const Q &entity);
+    void reserve(size_t n);
+    void clear();
+  };
+
+  const Columns &funcCols() const { return func_cols_; }
+  const Columns &typeCols() const { return type_cols_; }
+  const Columns &varCols() const { return var_cols_; }
+
   void clear();
 
   template <typename Def> void removeUsrs(Kind kind, int file_id, const std::vector<std::pair<Usr, Def>> &to_remove);
   // Insert the contents of |update| into |db|.
   void applyIndexUpdate(IndexUpdate *update);
   int getFileId(const std::string &path);
+  // Returns the index of the entity of |usr|, creating it if absent.
+  int entityId(Kind kind, Usr usr);
+  // Refresh the columns of every entity after its defs have been rewritten in
+  // place.
+  void updateColumns();
   int update(QueryFile::DefUpdate &&u);
-  void update(const Lid2file_id &, int file_id, std::vector<std::pair<Usr, QueryType::Def>> &&us);
-  void update(const Lid2file_id &, int file_id, std::vector<std::pair<Usr, QueryFunc::Def>> &&us);
-  void update(const Lid2file_id &, int file_id, std::vector<std::pair<Usr, QueryVar::Def>> &&us);
+  void update(const Lid2file_id &, int file_id, std::vector<std::pair<Usr, QueryType::UsrDef>> &&us,
+              std::vector<RefcntDelta> &refcnt);
+  void update(const Lid2file_id &, int file_id, std::vector<std::pair<Usr, QueryFunc::UsrDef>> &&us,
+              std::vector<RefcntDelta> &refcnt);
+  void update(const Lid2file_id &, int file_id, std::vector<std::pair<Usr, QueryVar::Def>> &&us,
+              std::vector<RefcntDelta> &refcnt);
   std::string_view getSymbolName(SymbolIdx sym, bool qualified);
   std::vector<uint8_t> getFileSet(const std::vector<std::string> &folders);
 
@@ -168,16 +346,19 @@ struct DB {
   QueryFunc &getFunc(SymbolIdx ref) { return getFunc(ref.usr); }
   QueryType &getType(SymbolIdx ref) { return getType(ref.usr); }
   QueryVar &getVar(SymbolIdx ref) { return getVar(ref.usr); }
+
+private:
+  Columns func_cols_, type_cols_, var_cols_;
 };
 
 Maybe<DeclRef> getDefinitionSpell(DB *db, SymbolIdx sym);
 
 // Get defining declaration (if exists) or an arbitrary declaration (otherwise)
-// for each id.
-std::vector<Use> getFuncDeclarations(DB *, const std::vector<Usr> &);
-std::vector<Use> getFuncDeclarations(DB *, const Vec<Usr> &);
-std::vector<Use> getTypeDeclarations(DB *, const std::vector<Usr> &);
-std::vector<DeclRef> getVarDeclarations(DB *, const std::vector<Usr> &, unsigned);
+// for each entity index.
+std::vector<Use> getFuncDeclarations(DB *, const std::vector<int> &);
+std::vector<Use> getFuncDeclarations(DB *, const Vec<int> &);
+std::vector<Use> getTypeDeclarations(DB *, const std::vector<int> &);
+std::vector<DeclRef> getVarDeclarations(DB *, const std::vector<int> &, unsigned);
 
 // Get non-defining declarations.
 std::vector<DeclRef> &getNonDefDeclarations(DB *db, SymbolIdx sym);
@@ -237,11 +418,26 @@ template <typename Fn> void eachOccurrence(DB *db, SymbolIdx sym, bool include_d
   });
 }
 
+// Uses and declarations of an entity are sorted by file_id. Call |fn| with the
+// span of each file, so that callers can skip unwanted files or do per-file
+// work once.
+template <typename T, typename Fn> void eachFileSpan(const std::vector<T> &uses, Fn &&fn) {
+  for (auto first = uses.begin(); first != uses.end();) {
+    int file_id = first->file_id;
+    auto last = std::upper_bound(first, uses.end(), file_id, [](int id, const T &x) { return id < x.file_id; });
+    fn(file_id, first, last);
+    first = last;
+  }
+}
+
+template <typename Fn> void eachFileSpan(const UseList &uses, Fn &&fn) { uses.eachFile(fn); }
+
 SymbolKind getSymbolKind(DB *db, SymbolIdx sym);
 
-template <typename C, typename Fn> void eachDefinedFunc(DB *db, const C &usrs, Fn &&fn) {
-  for (Usr usr : usrs) {
-    auto &obj = db->getFunc(usr);
+// |ids| are indices into DB::funcs.
+template <typename C, typename Fn> void eachDefinedFunc(DB *db, const C &ids, Fn &&fn) {
+  for (int id : ids) {
+    auto &obj = db->funcs[id];
     if (!obj.def.empty())
       fn(obj);
   }
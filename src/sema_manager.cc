@@ -452,6 +452,11 @@ void *completionMain(void *manager_) {
       if (pipeline::g_quit.load(std::memory_order_relaxed))
         break;
     }
+    if (pipeline::isCancelled(task->id)) {
+      manager->on_dropped_(task->id);
+      task->on_complete(nullptr);
+      continue;
+    }
 
     std::shared_ptr<Session> session = manager->ensureSession(task->path);
     std::shared_ptr<PreambleData> preamble = session->getPreamble();
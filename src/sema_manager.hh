@@ -80,8 +80,7 @@ struct Session {
   WorkingFiles *wfiles;
   bool inferred = false;
 
-  // TODO share
-  llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs = llvm::vfs::getRealFileSystem();
+  llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs = getCachingFileSystem();
   std::shared_ptr<clang::PCHContainerOperations> pch;
 
   Session(const Project::Entry &file, WorkingFiles *wfiles, std::shared_ptr<clang::PCHContainerOperations> pch)
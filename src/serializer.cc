@@ -16,6 +16,7 @@
 #include <llvm/ADT/STLExtras.h>
 #include <llvm/Support/Allocator.h>
 
+#include <atomic>
 #include <mutex>
 #include <stdexcept>
 
@@ -115,7 +116,7 @@ void reflect(BinaryReader &vis, unsigned long &v     ) { v = (unsigned long)vis.
 void reflect(BinaryReader &vis, long long &v         ) { v = vis.varInt(); }
 void reflect(BinaryReader &vis, unsigned long long &v) { v = vis.varUInt(); }
 void reflect(BinaryReader &vis, double &v            ) { v = vis.get<double>(); }
-void reflect(BinaryReader &vis, const char *&v       ) { v = intern(vis.getString()); }
+void reflect(BinaryReader &vis, const char *&v       ) { v = vis.getTableString(); }
 void reflect(BinaryReader &vis, std::string &v       ) { v = vis.getString(); }
 
 void reflect(BinaryWriter &vis, bool &v              ) { vis.pack(v); }
@@ -129,7 +130,7 @@ void reflect(BinaryWriter &vis, unsigned long &v     ) { vis.varUInt(v); }
 void reflect(BinaryWriter &vis, long long &v         ) { vis.varInt(v); }
 void reflect(BinaryWriter &vis, unsigned long long &v) { vis.varUInt(v); }
 void reflect(BinaryWriter &vis, double &v            ) { vis.pack(v); }
-void reflect(BinaryWriter &vis, const char *&v       ) { vis.string(v); }
+void reflect(BinaryWriter &vis, const char *&v       ) { vis.varUInt(vis.stringIndex(v)); }
 void reflect(BinaryWriter &vis, std::string &v       ) { vis.string(v.c_str(), v.size()); }
 // clang-format on
 
@@ -391,27 +392,136 @@ void reflectMemberStart(JsonReader &vis) {
     throw std::invalid_argument("object");
 }
 
-static BumpPtrAllocator alloc;
-static DenseSet<CachedHashStringRef> strings;
-static std::mutex allocMutex;
+namespace {
+struct InternSet {
+  BumpPtrAllocator alloc;
+  DenseSet<CachedHashStringRef> strings;
+
+  // Returns the interned copy and whether it is new.
+  std::pair<CachedHashStringRef, bool> insert(CachedHashStringRef hs) {
+    auto r = strings.insert(hs);
+    if (r.second) {
+      StringRef s = hs.val();
+      char *p = alloc.Allocate<char>(s.size() + 1);
+      memcpy(p, s.data(), s.size());
+      p[s.size()] = '\0';
+      *r.first = CachedHashStringRef(StringRef(p, s.size()), hs.hash());
+    }
+    return {*r.first, r.second};
+  }
+};
+
+// The interned strings are split into shards by hash, each with its own lock,
+// so that indexer threads interning different strings rarely contend.
+//
+// |strings| are never freed. |gen| holds the strings returned by
+// internReclaimable, which compactStrings copies to a new generation if they
+// are still referenced.
+struct alignas(64) InternShard {
+  std::mutex mutex;
+  InternSet strings, gen;
+
+  CachedHashStringRef intern(CachedHashStringRef hs) { return strings.insert(hs).first; }
+  CachedHashStringRef internReclaimable(CachedHashStringRef hs);
+};
+
+constexpr unsigned kInternShards = 64;
+InternShard internShards[kInternShards];
+// Bytes in the |gen| of all shards, and in the live ones after the last
+// compaction.
+std::atomic<size_t> reclaimableBytes;
+size_t liveBytes;
+
+// DenseSet buckets by the low bits of the hash. Use the high bits.
+unsigned shardIndex(uint32_t hash) { return hash >> 26; }
+static_assert(kInternShards == 1 << (32 - 26));
+
+CachedHashStringRef InternShard::internReclaimable(CachedHashStringRef hs) {
+  auto it = strings.strings.find(hs);
+  if (it != strings.strings.end())
+    return *it;
+  auto [ret, inserted] = gen.insert(hs);
+  if (inserted)
+    reclaimableBytes.fetch_add(hs.size() + 1, std::memory_order_relaxed);
+  return ret;
+}
+} // namespace
 
 CachedHashStringRef internH(StringRef s) {
   if (s.empty())
     s = "";
-  CachedHashString hs(s);
-  std::lock_guard lock(allocMutex);
-  auto r = strings.insert(hs);
-  if (r.second) {
-    char *p = alloc.Allocate<char>(s.size() + 1);
-    memcpy(p, s.data(), s.size());
-    p[s.size()] = '\0';
-    *r.first = CachedHashStringRef(StringRef(p, s.size()), hs.hash());
-  }
-  return *r.first;
+  CachedHashStringRef hs(s);
+  InternShard &shard = internShards[shardIndex(hs.hash())];
+  std::lock_guard lock(shard.mutex);
+  return shard.intern(hs);
 }
 
 const char *intern(StringRef s) { return internH(s).val().data(); }
 
+const char *internReclaimable(StringRef s) {
+  if (s.empty())
+    s = "";
+  CachedHashStringRef hs(s);
+  InternShard &shard = internShards[shardIndex(hs.hash())];
+  std::lock_guard lock(shard.mutex);
+  return shard.internReclaimable(hs).val().data();
+}
+
+bool compactStrings(function_ref<bool()> quiescent,
+                    function_ref<void(function_ref<const char *(const char *)>)> rewrite) {
+  size_t bytes = reclaimableBytes.load(std::memory_order_relaxed);
+  if (bytes < (64 << 20) || bytes < 2 * liveBytes)
+    return false;
+  std::unique_lock<std::mutex> locks[kInternShards];
+  for (unsigned i = 0; i < kInternShards; i++)
+    locks[i] = std::unique_lock(internShards[i].mutex);
+  if (!quiescent())
+    return false;
+
+  // Start a new generation and copy the strings that are still referenced. The
+  // old one is freed on return.
+  std::vector<InternSet> old(kInternShards);
+  for (unsigned i = 0; i < kInternShards; i++)
+    std::swap(old[i], internShards[i].gen);
+  reclaimableBytes.store(0, std::memory_order_relaxed);
+  rewrite([](const char *p) {
+    CachedHashStringRef hs(p);
+    return internShards[shardIndex(hs.hash())].internReclaimable(hs).val().data();
+  });
+  liveBytes = reclaimableBytes.load(std::memory_order_relaxed);
+  LOG_S(INFO) << "compacted interned strings from " << bytes << " to " << liveBytes << " bytes";
+  return true;
+}
+
+// Intern the strings of a string table, locking each shard once.
+static void internAll(ArrayRef<StringRef> strs, std::vector<const char *> &out) {
+  std::vector<CachedHashStringRef> hashed(strs.begin(), strs.end());
+  // Counting sort of the indices by shard.
+  unsigned start[kInternShards + 1] = {};
+  for (CachedHashStringRef hs : hashed)
+    start[shardIndex(hs.hash()) + 1]++;
+  for (unsigned i = 0; i < kInternShards; i++)
+    start[i + 1] += start[i];
+  std::vector<uint32_t> order(hashed.size());
+  {
+    unsigned pos[kInternShards];
+    std::copy(start, start + kInternShards, pos);
+    for (uint32_t i = 0; i < hashed.size(); i++)
+      order[pos[shardIndex(hashed[i].hash())]++] = i;
+  }
+
+  size_t base = out.size();
+  out.resize(base + hashed.size());
+  for (unsigned i = 0; i < kInternShards; i++) {
+    if (start[i] == start[i + 1])
+      continue;
+    InternShard &shard = internShards[i];
+    std::lock_guard lock(shard.mutex);
+    for (unsigned j = start[i]; j < start[i + 1]; j++)
+      out[base + order[j]] = shard.internReclaimable(hashed[order[j]]).val().data();
+  }
+}
+
 std::string serialize(SerializeFormat format, IndexFile &file) {
   switch (format) {
   case SerializeFormat::Binary: {
@@ -420,7 +530,18 @@ std::string serialize(SerializeFormat format, IndexFile &file) {
     int minor = IndexFile::kMinorVersion;
     reflect(writer, major);
     reflect(writer, minor);
+    // Placeholder for the offset of the string table.
+    size_t table_pos = writer.buf_.size();
+    writer.pack<uint64_t>(0);
     reflectFile(writer, file);
+    uint64_t table_offset = writer.buf_.size();
+    memcpy(writer.buf_.data() + table_pos, &table_offset, sizeof(table_offset));
+    writer.varUInt(writer.strings_.size());
+    for (std::string_view s : writer.strings_)
+      writer.string(s.data(), s.size());
+    // The trailing NUL guarantees BinaryReader::getString stops inside the
+    // buffer, which may be memory mapped and not NUL-terminated.
+    writer.pack<char>(0);
     return writer.take();
   }
   case SerializeFormat::Json: {
@@ -443,7 +564,7 @@ std::string serialize(SerializeFormat format, IndexFile &file) {
 }
 
 std::unique_ptr<IndexFile> deserialize(SerializeFormat format, const std::string &path,
-                                       const std::string &serialized_index_content, const std::string &file_content,
+                                       std::string_view serialized_index_content, const std::string &file_content,
                                        std::optional<int> expected_version) {
   if (serialized_index_content.empty())
     return nullptr;
@@ -453,13 +574,32 @@ std::unique_ptr<IndexFile> deserialize(SerializeFormat format, const std::string
   case SerializeFormat::Binary: {
     try {
       int major, minor;
-      if (serialized_index_content.size() < 8)
+      if (serialized_index_content.size() < 16 || serialized_index_content.back() != '\0')
         throw std::invalid_argument("Invalid");
       BinaryReader reader(serialized_index_content);
       reflect(reader, major);
       reflect(reader, minor);
       if (major != IndexFile::kMajorVersion || minor != IndexFile::kMinorVersion)
         throw std::invalid_argument("Invalid version");
+      auto table_offset = reader.get<uint64_t>();
+      if (table_offset >= serialized_index_content.size())
+        throw std::invalid_argument("Invalid string table");
+      {
+        std::string_view buf = serialized_index_content.substr(table_offset);
+        uint8_t tag = buf[0];
+        if ((tag < 253 ? 1 : tag == 253 ? 3 : tag == 254 ? 5 : 9) > buf.size())
+          throw std::invalid_argument("Invalid string table");
+        BinaryReader table(buf);
+        // Each string takes at least its NUL and the table ends with a NUL,
+        // so a count not below the remaining bytes is corrupt.
+        uint64_t n = table.varUInt();
+        if (n >= uint64_t(buf.data() + buf.size() - table.p_))
+          throw std::invalid_argument("Invalid string table");
+        std::vector<StringRef> strs(n);
+        for (StringRef &s : strs)
+          s = table.getString();
+        internAll(strs, reader.strings_);
+      }
       file = std::make_unique<IndexFile>(path, file_content, false);
       reflectFile(reader, *file);
     } catch (std::invalid_argument &e) {
@@ -471,14 +611,14 @@ std::unique_ptr<IndexFile> deserialize(SerializeFormat format, const std::string
   case SerializeFormat::Json: {
     rapidjson::Document reader;
     if (gTestOutputMode || !expected_version) {
-      reader.Parse(serialized_index_content.c_str());
+      reader.Parse(serialized_index_content.data(), serialized_index_content.size());
     } else {
-      const char *p = strchr(serialized_index_content.c_str(), '\n');
-      if (!p)
+      size_t p = serialized_index_content.find('\n');
+      if (p == std::string_view::npos)
         return nullptr;
-      if (atoi(serialized_index_content.c_str()) != *expected_version)
+      if (atoi(std::string(serialized_index_content.substr(0, p)).c_str()) != *expected_version)
         return nullptr;
-      reader.Parse(p + 1);
+      reader.Parse(serialized_index_content.data() + p + 1, serialized_index_content.size() - p - 1);
     }
     if (reader.HasParseError())
       return nullptr;
@@ -495,32 +635,36 @@ std::unique_ptr<IndexFile> deserialize(SerializeFormat format, const std::string
   }
   }
 
-  // Restore non-serialized state.
+  // Restore non-serialized state. Strings of the binary format are
+  // reclaimable. Pin the paths and arguments, which are not rewritten by
+  // compactStrings.
   file->path = path;
-  if (g_config->clang.pathMappings.size()) {
+  bool mapping = g_config->clang.pathMappings.size();
+  if (mapping)
     doPathMapping(file->import_file);
-    std::vector<const char *> args;
-    for (const char *arg : file->args) {
-      std::string s(arg);
+  for (const char *&arg : file->args) {
+    std::string s(arg);
+    if (mapping)
       doPathMapping(s);
-      args.push_back(intern(s));
-    }
-    file->args = std::move(args);
+    arg = intern(s);
+  }
+  if (mapping)
     for (auto &[_, path] : file->lid2path)
       doPathMapping(path);
-    for (auto &include : file->includes) {
-      std::string p(include.resolved_path);
+  for (auto &include : file->includes) {
+    std::string p(include.resolved_path);
+    if (mapping)
       doPathMapping(p);
-      include.resolved_path = intern(p);
-    }
-    decltype(file->dependencies) dependencies;
-    for (auto &it : file->dependencies) {
-      std::string path = it.first.val().str();
+    include.resolved_path = intern(p);
+  }
+  decltype(file->dependencies) dependencies;
+  for (auto &it : file->dependencies) {
+    std::string path = it.first.val().str();
+    if (mapping)
       doPathMapping(path);
-      dependencies[internH(path)] = it.second;
-    }
-    file->dependencies = std::move(dependencies);
+    dependencies[internH(path)] = it.second;
   }
+  file->dependencies = std::move(dependencies);
   return file;
 }
 } // namespace ccls
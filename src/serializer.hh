@@ -14,9 +14,11 @@
 #include <functional>
 #include <memory>
 #include <optional>
+#include <stdexcept>
 #include <string>
 #include <string_view>
 #include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 namespace llvm {
@@ -64,6 +66,8 @@ struct JsonWriter {
 
 struct BinaryReader {
   const char *p_;
+  // The string table. A const char * is serialized as an index into it.
+  std::vector<const char *> strings_;
 
   BinaryReader(std::string_view buf) : p_(buf.data()) {}
   template <typename T> T get() {
@@ -93,10 +97,20 @@ struct BinaryReader {
     p_++;
     return ret;
   }
+  const char *getTableString() {
+    auto i = varUInt();
+    if (i >= strings_.size())
+      throw std::invalid_argument("string index");
+    return strings_[i];
+  }
 };
 
 struct BinaryWriter {
   std::string buf_;
+  // The string table, written after the body so that repeated names and paths
+  // are stored and interned once.
+  std::vector<std::string_view> strings_;
+  std::unordered_map<std::string_view, unsigned> string2idx_;
 
   template <typename T> void pack(T x) {
     auto i = buf_.size();
@@ -119,6 +133,12 @@ struct BinaryWriter {
     }
   }
   void varInt(int64_t n) { varUInt(uint64_t(n) << 1 ^ n >> 63); }
+  unsigned stringIndex(const char *x) {
+    auto r = string2idx_.try_emplace(x, strings_.size());
+    if (r.second)
+      strings_.push_back(r.first->first);
+    return r.first->second;
+  }
   std::string take() { return std::move(buf_); }
 
   void string(const char *x) { string(x, strlen(x)); }
@@ -342,7 +362,9 @@ template <typename T> void reflect(JsonWriter &vis, std::vector<T> &v) {
   vis.endArray();
 }
 template <typename T> void reflect(BinaryReader &vis, std::vector<T> &v) {
-  for (auto n = vis.varUInt(); n; n--) {
+  auto n = vis.varUInt();
+  v.reserve(v.size() + n);
+  for (; n; n--) {
     v.emplace_back();
     reflect(vis, v.back());
   }
@@ -376,8 +398,17 @@ template <typename T> void reflectMember(BinaryWriter &vis, const char *, T &v)
 
 const char *intern(llvm::StringRef str);
 llvm::CachedHashStringRef internH(llvm::StringRef str);
+// Like intern, but the string is freed by compactStrings unless |rewrite|
+// replaces the pointers to it.
+const char *internReclaimable(llvm::StringRef str);
+// If enough reclaimable strings have been interned since the last compaction,
+// and |quiescent| returns true (called with the interner locked), start a new
+// generation. |rewrite| must pass every reachable pointer returned by
+// internReclaimable to the callback and store the result.
+bool compactStrings(llvm::function_ref<bool()> quiescent,
+                    llvm::function_ref<void(llvm::function_ref<const char *(const char *)>)> rewrite);
 std::string serialize(SerializeFormat format, IndexFile &file);
 std::unique_ptr<IndexFile> deserialize(SerializeFormat format, const std::string &path,
-                                       const std::string &serialized_index_content, const std::string &file_content,
+                                       std::string_view serialized_index_content, const std::string &file_content,
                                        std::optional<int> expected_version);
 } // namespace ccls
@@ -288,7 +288,7 @@ bool runIndexTests(const std::string &filter_path, bool enable_update) {
     for (auto &arg : args)
       cargs.push_back(arg.c_str());
     bool ok;
-    auto result = ccls::idx::index(&wfiles, &vfs, "", path, cargs, {}, true, ok);
+    auto result = ccls::idx::index(&wfiles, &vfs, "", path, cargs, {}, true, false, ok);
 
     for (const auto &entry : all_expected_output) {
       const std::string &expected_path = entry.first;
@@ -10,6 +10,7 @@
 #include <condition_variable>
 #include <deque>
 #include <mutex>
+#include <memory>
 #include <optional>
 #include <tuple>
 #include <utility>
@@ -166,4 +167,80 @@ private:
   MultiQueueWaiter *waiter_;
   std::unique_ptr<MultiQueueWaiter> owned_waiter_;
 };
+
+// A queue with |Lanes| priority lanes (0 is the highest). Each lane is a FIFO
+// deque with its own mutex, so producers and consumers of different lanes do
+// not contend, and a consumer takes the front of the highest non-empty lane:
+// requests in a high lane never wait behind a low lane, and requests in one
+// lane are popped in the order they were pushed. mutex_ is only used by
+// MultiQueueWaiter.
+template <class T, int Lanes> struct LaneQueue : public BaseThreadQueue {
+  using LaneArray = std::deque<T>[Lanes];
+
+  explicit LaneQueue(MultiQueueWaiter *waiter) : waiter_(waiter) {}
+
+  bool isEmpty() override { return total_count_ == 0; }
+
+  void pushBack(T &&t, int lane) {
+    {
+      std::lock_guard lock(locks_[lane].mutex);
+      lanes_[lane].push_back(std::move(t));
+      ++locks_[lane].count;
+      ++total_count_;
+    }
+    // Pair with the check in MultiQueueWaiter::wait to avoid a lost wakeup.
+    {
+      std::lock_guard lock(mutex_);
+    }
+    waiter_->cv.notify_one();
+  }
+
+  std::optional<T> tryPopFront() {
+    for (int lane = 0; lane < Lanes; lane++) {
+      if (!locks_[lane].count)
+        continue;
+      std::lock_guard lock(locks_[lane].mutex);
+      std::deque<T> &q = lanes_[lane];
+      if (q.empty())
+        continue;
+      T val = std::move(q.front());
+      q.pop_front();
+      --locks_[lane].count;
+      --total_count_;
+      return val;
+    }
+    return std::nullopt;
+  }
+
+  // Call |fn| with the lanes while holding the locks of lanes [first, Lanes).
+  // |fn| may only modify those lanes; consumers of higher lanes are not
+  // blocked.
+  template <typename Fn> void apply(Fn fn, int first = 0) {
+    std::unique_lock<std::mutex> locks[Lanes];
+    int old_size[Lanes];
+    for (int lane = first; lane < Lanes; lane++) {
+      locks[lane] = std::unique_lock(locks_[lane].mutex);
+      old_size[lane] = lanes_[lane].size();
+    }
+    fn(lanes_);
+    for (int lane = first; lane < Lanes; lane++) {
+      int delta = int(lanes_[lane].size()) - old_size[lane];
+      locks_[lane].count += delta;
+      total_count_ += delta;
+    }
+  }
+
+  mutable std::mutex mutex_;
+
+private:
+  struct alignas(64) LaneLock {
+    std::mutex mutex;
+    std::atomic<int> count{0};
+  };
+
+  LaneLock locks_[Lanes];
+  LaneArray lanes_;
+  std::atomic<int> total_count_{0};
+  MultiQueueWaiter *waiter_;
+};
 } // namespace ccls
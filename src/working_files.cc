@@ -308,8 +308,11 @@ std::optional<int> WorkingFile::getBufferPosFromIndexPos(int line, int *column,
     return std::nullopt;
   }
 
-  if (index_to_buffer.empty())
-    computeLineMapping();
+  {
+    std::lock_guard lock(mapping_mutex);
+    if (index_to_buffer.empty())
+      computeLineMapping();
+  }
   return findMatchingLine(index_lines, index_to_buffer, line, column, buffer_lines, is_end);
 }
 
@@ -317,8 +320,11 @@ std::optional<int> WorkingFile::getIndexPosFromBufferPos(int line, int *column,
   if (line < 0 || line >= (int)buffer_lines.size())
     return std::nullopt;
 
-  if (buffer_to_index.empty())
-    computeLineMapping();
+  {
+    std::lock_guard lock(mapping_mutex);
+    if (buffer_to_index.empty())
+      computeLineMapping();
+  }
   return findMatchingLine(buffer_lines, buffer_to_index, line, column, index_lines, is_end);
 }
 
@@ -334,6 +340,8 @@ Position WorkingFile::getCompletionPosition(Position pos, std::string *filter) c
   return getPositionForOffset(buffer_content, i);
 }
 
+thread_local int WorkingFiles::client = -1;
+
 WorkingFile *WorkingFiles::getFile(const std::string &path) {
   std::lock_guard lock(mutex);
   return getFileUnlocked(path);
@@ -341,13 +349,20 @@ WorkingFile *WorkingFiles::getFile(const std::string &path) {
 
 WorkingFile *WorkingFiles::getFileUnlocked(const std::string &path) {
   auto it = files.find(path);
-  return it != files.end() ? it->second.get() : nullptr;
+  if (it == files.end())
+    return nullptr;
+  if (client >= 0) {
+    auto &bufs = buffers.find(path)->second;
+    if (auto it1 = bufs.find(client); it1 != bufs.end())
+      return it1->second.get();
+  }
+  return it->second;
 }
 
 std::string WorkingFiles::getContent(const std::string &path) {
   std::lock_guard lock(mutex);
-  auto it = files.find(path);
-  return it != files.end() ? it->second->buffer_content : "";
+  WorkingFile *wf = getFileUnlocked(path);
+  return wf ? wf->buffer_content : "";
 }
 
 WorkingFile *WorkingFiles::onOpen(const TextDocumentItem &open) {
@@ -356,7 +371,7 @@ WorkingFile *WorkingFiles::onOpen(const TextDocumentItem &open) {
   std::string path = open.uri.getPath();
   std::string content = open.text;
 
-  auto &wf = files[path];
+  auto &wf = buffers[path][client];
   if (wf) {
     wf->version = open.version;
     wf->buffer_content = content;
@@ -364,6 +379,7 @@ WorkingFile *WorkingFiles::onOpen(const TextDocumentItem &open) {
   } else {
     wf = std::make_unique<WorkingFile>(path, content);
   }
+  files[path] = wf.get();
   return wf.get();
 }
 
@@ -371,11 +387,15 @@ void WorkingFiles::onChange(const TextDocumentDidChangeParam &change) {
   std::lock_guard lock(mutex);
 
   std::string path = change.textDocument.uri.getPath();
-  WorkingFile *file = getFileUnlocked(path);
+  WorkingFile *file = nullptr;
+  if (auto it = buffers.find(path); it != buffers.end())
+    if (auto it1 = it->second.find(client); it1 != it->second.end())
+      file = it1->second.get();
   if (!file) {
     LOG_S(WARNING) << "Could not change " << path << " because it was not open";
     return;
   }
+  files[path] = file;
 
   file->timestamp =
       chrono::duration_cast<chrono::seconds>(chrono::high_resolution_clock::now().time_since_epoch()).count();
@@ -402,9 +422,24 @@ void WorkingFiles::onChange(const TextDocumentDidChangeParam &change) {
   }
 }
 
-void WorkingFiles::onClose(const std::string &path) {
+bool WorkingFiles::onClose(const std::string &path) {
   std::lock_guard lock(mutex);
-  files.erase(path);
+  auto it = buffers.find(path);
+  if (it == buffers.end())
+    return true;
+  it->second.erase(client);
+  if (it->second.empty()) {
+    buffers.erase(it);
+    files.erase(path);
+    return true;
+  }
+  // Another client has it open. Fall back to its most recently changed buffer.
+  WorkingFile *last = nullptr;
+  for (auto &[_, wf] : it->second)
+    if (!last || wf->timestamp > last->timestamp)
+      last = wf.get();
+  files[path] = last;
+  return false;
 }
 
 // VSCode (UTF-16) disagrees with Emacs lsp-mode (UTF-8) on how to represent
@@ -6,6 +6,8 @@
 #include "lsp.hh"
 #include "utils.hh"
 
+#include <map>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <string>
@@ -30,6 +32,8 @@ struct WorkingFile {
   // confident lines to resolve its line number.
   std::vector<int> index_to_buffer;
   std::vector<int> buffer_to_index;
+  // Guards the lazy computation of the mappings by concurrent requests.
+  std::mutex mapping_mutex;
   // A set of diagnostics that have been reported for this file.
   std::vector<Diagnostic> diagnostics;
 
@@ -57,7 +61,13 @@ private:
   void computeLineMapping();
 };
 
+// In daemon mode, each client that opens a document has its own buffer of it.
+// The messages of a client are handled with |client| set to its id, so that
+// they see and change its buffers. Other threads (client == -1) see the buffer
+// last opened or changed by any client.
 struct WorkingFiles {
+  static thread_local int client;
+
   WorkingFile *getFile(const std::string &path);
   WorkingFile *getFileUnlocked(const std::string &path);
   std::string getContent(const std::string &path);
@@ -66,13 +76,25 @@ struct WorkingFiles {
     std::lock_guard lock(mutex);
     fn();
   }
+  // Call |fn| with the buffer of |path| of each client.
+  template <typename Fn> void eachBuffer(const std::string &path, Fn &&fn) {
+    std::lock_guard lock(mutex);
+    auto it = buffers.find(path);
+    if (it != buffers.end())
+      for (auto &[_, wf] : it->second)
+        fn(wf.get());
+  }
 
   WorkingFile *onOpen(const TextDocumentItem &open);
   void onChange(const TextDocumentDidChangeParam &change);
-  void onClose(const std::string &close);
+  // Return true if no client has |close| open any more.
+  bool onClose(const std::string &close);
 
   std::mutex mutex;
-  std::unordered_map<std::string, std::unique_ptr<WorkingFile>> files;
+  // The buffer of each open document last opened or changed.
+  std::unordered_map<std::string, WorkingFile *> files;
+  // The buffers of each open document keyed by client.
+  std::unordered_map<std::string, std::map<int, std::unique_ptr<WorkingFile>>> buffers;
 };
 
 int getOffsetForPosition(Position pos, std::string_view content);